@@ -0,0 +1,1581 @@
+#include "analysis.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "clang/AST/AST.h"
+#include "clang/AST/ASTTypeTraits.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Rewrite/Core/Rewriter.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/StringSaver.h"
+#include "llvm/Support/TimeProfiler.h"
+
+#include "async-output.h"
+#include "binary-format.h"
+#include "canonical-regions.h"
+#include "cfg-definedness.h"
+#include "compressed-output.h"
+#include "function-summary.h"
+#include "incremental.h"
+#include "libdbgcov.h"
+
+using namespace clang;
+using namespace llvm;
+using dbgcov::GetRegionKindName;
+using dbgcov::RegionKind;
+using dbgcov::RegionSink;
+#ifdef USE_STD_UNIQUE_PTR
+using std::make_unique;
+#else
+using llvm::make_unique;
+#endif
+
+// `dyn_cast_if_present` added in LLVM 15, replaces `dyn_cast_or_null`
+#ifdef HAVE_DYN_CAST_IF_PRESENT
+#define dyn_cast_if_present dyn_cast_if_present
+#else
+#define dyn_cast_if_present dyn_cast_or_null
+#endif
+
+llvm::cl::OptionCategory DbgCovCategory("DbgCov");
+
+llvm::cl::opt<OutputFormat> Format(
+    "output-format", llvm::cl::desc("Region output format"),
+    llvm::cl::values(
+        clEnumValN(OutputFormat::Text, "text",
+                   "Tab-separated text, one region per line (default)"),
+        clEnumValN(OutputFormat::Binary, "binary",
+                   "Compact binary format, see `dbgcov-dump`"),
+        clEnumValN(OutputFormat::Summary, "summary",
+                   "Only line counts for each function and variable")),
+    llvm::cl::init(OutputFormat::Text), llvm::cl::cat(DbgCovCategory));
+
+llvm::cl::opt<dbgcov::Compression> Compress(
+    "compress", llvm::cl::desc("Compress the output as it is written"),
+    llvm::cl::values(
+        clEnumValN(dbgcov::Compression::None, "none", "Don't (default)"),
+        clEnumValN(dbgcov::Compression::Zlib, "zlib", "With zlib"),
+        clEnumValN(dbgcov::Compression::Zstd, "zstd",
+                   "With zstd (needs LLVM 16 or later)")),
+    llvm::cl::init(dbgcov::Compression::None), llvm::cl::cat(DbgCovCategory));
+
+llvm::cl::opt<HeaderFunctionMode> HeaderFunctions(
+    "header-functions",
+    llvm::cl::desc("How to treat functions defined in headers (including "
+                   "system headers) rather than the main source file"),
+    llvm::cl::values(
+        clEnumValN(HeaderFunctionMode::All, "all",
+                   "Analyse them in every translation unit (default)"),
+        clEnumValN(HeaderFunctionMode::Skip, "skip",
+                   "Don't analyse them, nor parse their bodies"),
+        clEnumValN(HeaderFunctionMode::Once, "once",
+                   "Analyse each only once per build, using -header-index")),
+    llvm::cl::init(HeaderFunctionMode::All), llvm::cl::cat(DbgCovCategory));
+
+llvm::cl::opt<std::string> HeaderIndex(
+    "header-index",
+    llvm::cl::desc("Directory, shared by every translation unit of a build, "
+                   "recording which header functions have been analysed"),
+    llvm::cl::value_desc("directory"), llvm::cl::cat(DbgCovCategory));
+
+llvm::cl::opt<DefinednessMode> Definedness(
+    "definedness",
+    llvm::cl::desc("How to find where variables are defined"),
+    llvm::cl::values(
+        clEnumValN(DefinednessMode::Lexical, "lexical",
+                   "From each definition to the end of the enclosing block "
+                   "(default)"),
+        clEnumValN(DefinednessMode::Cfg, "cfg",
+                   "By dataflow over each function's control flow graph, in "
+                   "whole lines")),
+    llvm::cl::init(DefinednessMode::Lexical), llvm::cl::cat(DbgCovCategory));
+
+llvm::cl::opt<std::string> IncrementalCache(
+    "incremental-cache",
+    llvm::cl::desc("Reuse the regions of functions unchanged since the last "
+                   "run over this input, as recorded in the given file, and "
+                   "record this run's there"),
+    llvm::cl::value_desc("file"), llvm::cl::cat(DbgCovCategory));
+
+llvm::cl::opt<bool> PhaseTimings(
+    "phase-timings",
+    llvm::cl::desc("Report to stderr the time each input spent in parsing, "
+                   "traversal and region output (adds a little overhead per "
+                   "region; meant for benchmarking)"),
+    llvm::cl::cat(DbgCovCategory));
+
+static llvm::cl::opt<unsigned> TraverseJobs(
+    "traverse-jobs",
+    llvm::cl::desc("Once each input is parsed, traverse its function "
+                   "definitions on this many threads (default 1: traverse "
+                   "each as it is parsed; 0: one per hardware thread). Not "
+                   "used with -definedness=cfg, -incremental-cache or "
+                   "-pch-dir"),
+    llvm::cl::init(1), llvm::cl::cat(DbgCovCategory));
+
+static llvm::cl::opt<bool> Canonical(
+    "canonical",
+    llvm::cl::desc("Merge each function's overlapping regions, reduce "
+                   "computation to runs of lines, and sort the result"),
+    llvm::cl::cat(DbgCovCategory));
+
+static llvm::cl::opt<bool> OutputThread(
+    "output-thread",
+    llvm::cl::desc("Format and write regions on a separate thread, "
+                   "overlapping with parsing and traversal"),
+    llvm::cl::cat(DbgCovCategory));
+
+static llvm::cl::opt<std::string> FunctionFilter(
+    "function-filter",
+    llvm::cl::desc("Only analyse functions whose names match the given "
+                   "regular expression"),
+    llvm::cl::value_desc("regex"), llvm::cl::cat(DbgCovCategory));
+
+static llvm::cl::list<std::string> LineFilter(
+    "line-filter",
+    llvm::cl::desc("Only analyse functions, and report regions, overlapping "
+                   "the given lines; may be repeated. <file> is a path, or "
+                   "its trailing components"),
+    llvm::cl::value_desc("file:first-last"), llvm::cl::cat(DbgCovCategory));
+
+static llvm::cl::list<RegionKind> KindFilter(
+    "kinds",
+    llvm::cl::desc("Only find regions of the given kinds (default: all)"),
+    llvm::cl::values(
+        clEnumValN(RegionKind::Computation, "Computation", ""),
+        clEnumValN(RegionKind::DeclScope, "DeclScope", ""),
+        clEnumValN(RegionKind::MustBeDefined, "MustBeDefined", ""),
+        clEnumValN(RegionKind::MayBeDefined, "MayBeDefined", "")),
+    llvm::cl::CommaSeparated, llvm::cl::cat(DbgCovCategory));
+
+/* The filters, as parsed by `PrepareAnalysis`. They are applied as early as
+ * possible: functions outside them aren't traversed at all, and the work for
+ * a kind of region isn't done if the kind isn't wanted. */
+struct LineRange {
+  std::string File;
+  unsigned First;
+  unsigned Last;
+};
+static std::unique_ptr<Regex> FunctionRegex;
+static std::vector<LineRange> LineRanges;
+static unsigned EnabledKinds = (1u << dbgcov::NumRegionKinds) - 1;
+
+static bool IsKindEnabled(RegionKind kind) {
+  return EnabledKinds & (1u << static_cast<unsigned>(kind));
+}
+
+// Whether lines `first` to `last` of `path` overlap any `-line-filter`
+static bool IsInLineRanges(StringRef path, unsigned first, unsigned last) {
+  for (const auto &range : LineRanges) {
+    StringRef file = range.File;
+    bool sameFile = path == file ||
+                    (path.endswith(file) &&
+                     llvm::sys::path::is_separator(
+                         path[path.size() - file.size() - 1]));
+    if (sameFile && first <= range.Last && range.First <= last)
+      return true;
+  }
+  return false;
+}
+
+static Error ParseFilters() {
+  FunctionRegex.reset();
+  if (!FunctionFilter.empty()) {
+    FunctionRegex = make_unique<Regex>(FunctionFilter);
+    std::string error;
+    if (!FunctionRegex->isValid(error))
+      return createStringError(inconvertibleErrorCode(),
+                               "-function-filter: %s", error.c_str());
+  }
+
+  LineRanges.clear();
+  for (const auto &filter : LineFilter) {
+    // The file name may itself contain `:`
+    StringRef file, lines, first, last;
+    std::tie(file, lines) = StringRef(filter).rsplit(':');
+    std::tie(first, last) = lines.split('-');
+    LineRange range;
+    range.File = file.str();
+    if (file.empty() || first.getAsInteger(10, range.First) ||
+        last.getAsInteger(10, range.Last) || range.First > range.Last)
+      return createStringError(inconvertibleErrorCode(),
+                               "-line-filter=%s: expected <file>:<first>-<last>",
+                               filter.c_str());
+    LineRanges.push_back(std::move(range));
+  }
+
+  if (KindFilter.empty()) {
+    EnabledKinds = (1u << dbgcov::NumRegionKinds) - 1;
+  } else {
+    EnabledKinds = 0;
+    for (RegionKind kind : KindFilter)
+      EnabledKinds |= 1u << static_cast<unsigned>(kind);
+  }
+  return Error::success();
+}
+
+// We have no `-stats` option of our own: LLVM's is already registered, and we
+// print our counts whenever it is set (see `AreStatisticsEnabled`).
+
+class DbgCovASTVisitor : public RecursiveASTVisitor<DbgCovASTVisitor> {
+public:
+  DbgCovASTVisitor(Rewriter &R, ASTContext &C, RegionSink &S)
+      : TheRewriter(R), TheContext(C), Sink(&S), Paths(StringAlloc),
+        Names(StringAlloc) {}
+
+  // For visitors on other threads: the lock to take around everything that
+  // uses the (not thread-safe) `SourceManager`
+  void SetSourceManagerLock(std::mutex &lock) { SourceManagerLock = &lock; }
+
+  // Send regions somewhere else from now on
+  void SetSink(RegionSink &S) {
+    assert(Pending.empty() && "Regions recorded for the old sink not emitted");
+    Sink = &S;
+  }
+
+  // Utilities
+
+  // What is needed of a `PresumedLoc`
+  struct ResolvedLocation {
+    const char *Filename;
+    unsigned Line;
+    unsigned Column;
+  };
+
+  // `declLoc` is where `decl` is, as resolved by `EmitPendingRegions`; it is
+  // only used the first time a name is asked for
+  StringRef GetExtendedName(const NamedDecl &decl,
+                            const ResolvedLocation &declLoc) {
+    // A variable is typically named by many regions, so build its name once
+    StringRef &cached = ExtendedNames[&decl];
+    if (cached.data())
+      return cached;
+
+    // TODO: Support C++ `BlockDecl`s
+    const auto *functionDecl = cast<FunctionDecl>(decl.getDeclContext());
+
+    // The precise name format here must match `debuginfo-quality` so we can match
+    // data across both tools.
+    // <function>, <variable>, decl <file>:<line>
+    SmallString<128> name;
+    raw_svector_ostream stream(name);
+    stream << functionDecl->getDeclName() << ", " << decl.getDeclName()
+           << ", decl " << llvm::sys::path::filename(declLoc.Filename) << ":"
+           << declLoc.Line;
+    cached = Names.save(name.str());
+    return cached;
+  }
+
+  StringRef GetAbsolutePath(const PresumedLoc &loc) {
+    return GetAbsolutePath(loc.getFilename());
+  }
+
+  // `filename` is a presumed filename, as from `PresumedLoc::getFilename`
+  StringRef GetAbsolutePath(const char *filename) {
+    // Presumed filenames are interned by the `SourceManager` (in its line
+    // table for `#line` markers, or as the file entry name otherwise), so the
+    // pointer identifies the file. We can't key on `FileID` here: a whole
+    // preprocessed file is a single `FileID` covering many presumed files.
+    StringRef &cached = AbsolutePaths[filename];
+    if (cached.data())
+      return cached;
+
+    // Resolve against the file system the tool ran with, whose working
+    // directory is that of the compile command (and not necessarily ours)
+    SmallString<128> filePath(filename);
+    std::error_code error = TheRewriter.getSourceMgr()
+                                .getFileManager()
+                                .getVirtualFileSystem()
+                                .makeAbsolute(filePath);
+    assert(!error && "Unable to make absolute path");
+    // Interned, so equal paths compare equal by pointer
+    cached = Paths.save(filePath.str());
+    return cached;
+  }
+
+  /* Regions are recorded during traversal with their raw locations, and only
+   * resolved to presumed (file, line, column) locations in a batch once the
+   * top-level declaration they came from has been traversed; see
+   * `EmitPendingRegions`. Each `getPresumedLoc` has to find the location's
+   * `FileID`, line and `#line` marker, which is much cheaper done in file
+   * offset order (the `SourceManager` caches its last lookups) and once per
+   * distinct location. */
+  struct PendingRegion {
+    SourceLocation Begin;
+    SourceLocation End;
+    // Named by `GetExtendedName(*Var)` if set, otherwise by `Detail`
+    const NamedDecl *Var;
+    const char *Detail;
+    // Only for whole-line regions, whose `Begin` just gives the file
+    unsigned BeginLine;
+    unsigned EndLine;
+    RegionKind Kind;
+    uint8_t Method;
+    bool BeginNextLine;
+    bool WholeLines;
+  };
+
+  bool IsSameFile(const ResolvedLocation &a, const ResolvedLocation &b) {
+    return a.Filename == b.Filename ||
+           GetAbsolutePath(a.Filename).data() ==
+               GetAbsolutePath(b.Filename).data();
+  }
+
+  void PrintLocation(raw_ostream &stream, const ResolvedLocation &loc) {
+    stream << GetAbsolutePath(loc.Filename) << ":" << loc.Line << ":"
+           << loc.Column;
+  }
+
+  void PrintRegion(SourceLocation begin, SourceLocation end, RegionKind kind,
+                   const char *detail, bool beginNextLine) {
+    if (IsKindEnabled(kind))
+      AddPendingRegion(begin, end, kind, nullptr, detail, beginNextLine);
+  }
+
+  void PrintRegion(SourceLocation begin, SourceLocation end, RegionKind kind,
+                   const NamedDecl &var, bool beginNextLine) {
+    if (IsKindEnabled(kind))
+      AddPendingRegion(begin, end, kind, &var, nullptr, beginNextLine);
+  }
+
+  // Report whole lines, as found by `-definedness=cfg`, with both columns 0.
+  // `loc` is anywhere in the file they are in.
+  void PrintLineRegion(SourceLocation loc, unsigned beginLine,
+                       unsigned endLine, RegionKind kind,
+                       const NamedDecl &var) {
+    if (!IsKindEnabled(kind))
+      return;
+    AddPendingRegion(loc, loc, kind, &var, nullptr,
+                     /* beginNextLine = */ false);
+    Pending.back().BeginLine = beginLine;
+    Pending.back().EndLine = endLine;
+    Pending.back().WholeLines = true;
+  }
+
+  void AddPendingRegion(SourceLocation begin, SourceLocation end,
+                        RegionKind kind, const NamedDecl *var,
+                        const char *detail, bool beginNextLine) {
+    PendingRegion region;
+    region.Begin = begin;
+    region.End = end;
+    region.Var = var;
+    region.Detail = detail;
+    region.BeginLine = 0;
+    region.EndLine = 0;
+    region.Kind = kind;
+    region.Method = static_cast<uint8_t>(CurrentMethod);
+    region.BeginNextLine = beginNextLine;
+    region.WholeLines = false;
+    Pending.push_back(region);
+  }
+
+  // Resolve the locations of the regions recorded so far, and send them to
+  // the sink in the order they were recorded. Only the resolving needs the
+  // `SourceManager`, so other threads can use it while we build the regions.
+  void EmitPendingRegions() {
+    if (Pending.empty())
+      return;
+    ResolvePendingLocations();
+    for (size_t i = 0; i < Pending.size(); ++i)
+      EmitRegion(Pending[i], Resolved[2 * i], Resolved[2 * i + 1]);
+    Pending.clear();
+    DeclLocations.clear();
+  }
+
+  // Fill in `Resolved` for `Pending`, and `DeclLocations` for the variables
+  // it names that have no name built yet
+  void ResolvePendingLocations() {
+    std::unique_lock<std::mutex> lock = LockSourceManager();
+    const auto &mgr = TheRewriter.getSourceMgr();
+    auto resolve = [&mgr](SourceLocation loc, ResolvedLocation &resolved) {
+      PresumedLoc pLoc = mgr.getPresumedLoc(loc);
+      assert(pLoc.isValid() && "Invalid location");
+      resolved.Filename = pLoc.getFilename();
+      resolved.Line = pLoc.getLine();
+      resolved.Column = pLoc.getColumn();
+    };
+
+    // Both ends of every region, with their index in `Resolved`. Preprocessed
+    // input has no macro expansions, but original sources (with `-pch-dir`,
+    // or in the plugin) do: code from a macro is reported where the macro is
+    // used.
+    PendingLocations.clear();
+    for (size_t i = 0; i < Pending.size(); ++i) {
+      const PendingRegion &region = Pending[i];
+      PendingLocations.emplace_back(mgr.getExpansionLoc(region.Begin), 2 * i);
+      PendingLocations.emplace_back(mgr.getExpansionLoc(region.End), 2 * i + 1);
+    }
+    // Raw encodings order file locations by `FileID`, then by offset
+    std::sort(PendingLocations.begin(), PendingLocations.end(),
+              [](const std::pair<SourceLocation, unsigned> &a,
+                 const std::pair<SourceLocation, unsigned> &b) {
+                return a.first < b.first;
+              });
+    Resolved.resize(PendingLocations.size());
+    for (size_t i = 0; i < PendingLocations.size(); ++i) {
+      SourceLocation loc = PendingLocations[i].first;
+      ResolvedLocation &resolved = Resolved[PendingLocations[i].second];
+      if (i > 0 && PendingLocations[i - 1].first == loc) {
+        resolved = Resolved[PendingLocations[i - 1].second];
+        continue;
+      }
+      resolve(loc, resolved);
+    }
+
+    for (const PendingRegion &region : Pending) {
+      if (region.Var && !ExtendedNames.lookup(region.Var).data() &&
+          !DeclLocations.count(region.Var))
+        resolve(region.Var->getLocation(), DeclLocations[region.Var]);
+    }
+  }
+
+  void EmitRegion(const PendingRegion &pending,
+                  const ResolvedLocation &beginLoc,
+                  const ResolvedLocation &endLoc) {
+    StringRef detail =
+        pending.Var
+            ? GetExtendedName(*pending.Var, DeclLocations.lookup(pending.Var))
+            : StringRef(pending.Detail);
+    dbgcov::Region region;
+    region.Path = GetAbsolutePath(beginLoc.Filename);
+    region.Kind = pending.Kind;
+    region.Detail = detail;
+    if (pending.WholeLines) {
+      if (!LineRanges.empty() &&
+          !IsInLineRanges(region.Path, pending.BeginLine, pending.EndLine))
+        return;
+      ++MethodRegions[pending.Method][static_cast<unsigned>(pending.Kind)];
+      region.BeginLine = pending.BeginLine;
+      region.BeginColumn = 0;
+      region.EndLine = pending.EndLine;
+      region.EndColumn = 0;
+      Sink->AddRegion(region);
+      return;
+    }
+
+    if (!IsSameFile(beginLoc, endLoc)) {
+      llvm::errs() << "Warning: Ignoring multi-file region\n";
+      PrintLocation(llvm::errs(), beginLoc);
+      llvm::errs() << "\n";
+      PrintLocation(llvm::errs(), endLoc);
+      llvm::errs() << "\n" << GetRegionKindName(pending.Kind) << "\n" << detail
+                   << "\n";
+      return;
+    }
+    if (beginLoc.Line > endLoc.Line) {
+      llvm::errs() << "Error: Invalid region (begin after end)\n";
+      PrintLocation(llvm::errs(), beginLoc);
+      llvm::errs() << "\n";
+      PrintLocation(llvm::errs(), endLoc);
+      llvm::errs() << "\n" << GetRegionKindName(pending.Kind) << "\n" << detail
+                   << "\n";
+    }
+    assert(beginLoc.Line <= endLoc.Line);
+    // Ensure that we don't move the begin line past the end line for
+    // single-line regions (e.g. macro invocations)
+    bool beginNextLine = pending.BeginNextLine && beginLoc.Line != endLoc.Line;
+    if (!LineRanges.empty() &&
+        !IsInLineRanges(region.Path, beginLoc.Line + beginNextLine,
+                        endLoc.Line))
+      return;
+    ++MethodRegions[pending.Method][static_cast<unsigned>(pending.Kind)];
+    if (beginNextLine) {
+      region.BeginLine = beginLoc.Line + 1;
+      region.BeginColumn = 0;
+    } else {
+      region.BeginLine = beginLoc.Line;
+      region.BeginColumn = beginLoc.Column;
+    }
+    region.EndLine = endLoc.Line;
+    region.EndColumn = endLoc.Column;
+    Sink->AddRegion(region);
+  }
+
+  // Report the definedness of a function's variables from its CFG, in place
+  // of the lexical reports. Returns false if the analysis couldn't be done.
+  bool ReportDefinednessFromCFG(const FunctionDecl &functionDecl) {
+    SourceLocation bodyLoc = functionDecl.getBody()->getBeginLoc();
+    if (bodyLoc.isInvalid())
+      return false;
+    return dbgcov::AnalyseDefinedness(
+        functionDecl, TheContext, [&](const dbgcov::DefinedLines &lines) {
+          PrintLineRegion(bodyLoc, lines.BeginLine, lines.EndLine, lines.Kind,
+                          *lines.Var);
+        });
+  }
+
+  const Stmt *GetParentStmt(const Stmt *stmt) {
+    // Look for the nearest `Stmt` ancestor
+    // C is statement-oriented, so all `Expr`s are also `Stmt`s
+    // In this case, we only want `Stmt`s that are _not_ `Expr`s, which are
+    // exactly those kept on `ParentStmts`. `stmt` is either the node being
+    // visited or (if it is not an `Expr`) the innermost entry on the stack.
+    auto it = ParentStmts.rbegin(), end = ParentStmts.rend();
+    if (it != end && *it == stmt)
+      ++it;
+    return it != end ? *it : nullptr;
+  }
+
+  // Whether `functionDecl` passes `-function-filter` and `-line-filter`
+  bool IsFunctionSelected(const FunctionDecl &functionDecl) {
+    if (FunctionRegex && !FunctionRegex->match(functionDecl.getNameAsString()))
+      return false;
+    if (LineRanges.empty())
+      return true;
+    std::unique_lock<std::mutex> lock = LockSourceManager();
+    const auto &mgr = TheRewriter.getSourceMgr();
+    PresumedLoc beginLoc =
+        mgr.getPresumedLoc(mgr.getExpansionLoc(functionDecl.getBeginLoc()));
+    PresumedLoc endLoc =
+        mgr.getPresumedLoc(mgr.getExpansionLoc(functionDecl.getEndLoc()));
+    if (beginLoc.isInvalid() || endLoc.isInvalid())
+      return true;
+    return IsInLineRanges(GetAbsolutePath(beginLoc), beginLoc.getLine(),
+                          endLoc.getLine());
+  }
+
+  // Traversal hooks
+
+  // Function definitions outside the filters are skipped, bodies and all
+  bool TraverseDecl(Decl *D) {
+    const auto *functionDecl = dyn_cast_if_present<FunctionDecl>(D);
+    if (functionDecl && functionDecl->doesThisDeclarationHaveABody() &&
+        !IsFunctionSelected(*functionDecl))
+      return true;
+    return RecursiveASTVisitor<DbgCovASTVisitor>::TraverseDecl(D);
+  }
+
+  // These bracket each `Stmt` as `RecursiveASTVisitor` works through its own
+  // data-recursion queue, so `ParentStmts` always holds the non-`Expr`
+  // ancestors of the node being visited. This replaces building a parent map
+  // and walking up it one `Expr` at a time for every region.
+  bool dataTraverseStmtPre(Stmt *s) {
+    if (!isa<Expr>(s))
+      ParentStmts.push_back(s);
+    return true;
+  }
+
+  bool dataTraverseStmtPost(Stmt *s) {
+    if (!isa<Expr>(s)) {
+      assert(!ParentStmts.empty() && ParentStmts.back() == s &&
+             "Unbalanced statement traversal");
+      ParentStmts.pop_back();
+    }
+    return true;
+  }
+
+  void ReportDeclRefExprAsDefined(const DeclRefExpr *declRefExpr,
+                                  const Stmt *stmtForRegionStart,
+                                  RegionKind regionKind,
+                                  bool beginNextLine) {
+    // The CFG analysis has already covered this function
+    if (CfgDefinedness)
+      return;
+    const auto *namedDecl = cast<NamedDecl>(declRefExpr->getDecl());
+    // Only examine variables inside functions
+    if (!isa<FunctionDecl>(namedDecl->getDeclContext()))
+      return;
+    // llvm::errs() << "Report for `" << namedDecl->getDeclName() << "`\n";
+    // s->dump();
+
+    const auto *parentStmt = GetParentStmt(stmtForRegionStart);
+    // Only examine variables within some kind of `Stmt`, such as a continuing
+    // `CompoundStmt` or blocks with associated declarations (e.g. `ForStmt`)
+    if (!parentStmt)
+      return;
+    // parentStmt->dump();
+
+    PrintRegion(stmtForRegionStart->getEndLoc(), parentStmt->getEndLoc(),
+                regionKind, *namedDecl, beginNextLine);
+  }
+
+  void ReportTreeAsDefined(const Expr *tree, const Stmt *stmtForRegionStart,
+                           RegionKind regionKind, bool beginNextLine) {
+    // Not worth walking the tree for regions that won't be reported
+    if (CfgDefinedness || !IsKindEnabled(regionKind))
+      return;
+    SmallVector<const Stmt *, 8> workQueue;
+    // Find all `DeclRefExpr`s within `tree`
+    workQueue.push_back(tree);
+    while (!workQueue.empty()) {
+      const auto *node = workQueue.back();
+      workQueue.pop_back();
+      // Add any children to the work queue
+      for (const auto *child : node->children())
+        workQueue.push_back(child);
+      // Report `DeclRefExpr` if found
+      if (!isa<DeclRefExpr>(node))
+        continue;
+      const auto *declRefExpr = cast<DeclRefExpr>(node);
+      ReportDeclRefExprAsDefined(declRefExpr, stmtForRegionStart, regionKind,
+                                 beginNextLine);
+    }
+  }
+
+  // Nodes with standardised handling
+
+  /* What can we "visit" using RecursiveASTVisitor?
+     - attributes or specific classes thereof
+     - statements or specific classes thereof -- expressions are a kind of statement!
+     - specific unary and binary operators
+     - compound assignments
+     - types
+     - decls
+
+     Of these, I *think* it is only expressions that contain code that executes at run time.
+     So let's focus on those... what kinds of expression are there? Expr is the base.
+     Problem: the taxonomy of statements/expressions is liable to change
+     across clang versions.
+
+     Let's use a macroised list to generate our visitors
+   */
+#define STMTS_TO_PRINT(v) \
+  v(ArraySubscriptExpr) \
+  v(CXXConstructExpr) \
+  v(CXXDefaultArgExpr) \
+  v(CXXFoldExpr) \
+  v(CXXInheritedCtorInitExpr) \
+  v(CXXNewExpr) \
+  v(CXXPseudoDestructorExpr) \
+  v(CXXScalarValueInitExpr) \
+  v(CXXTypeidExpr) \
+  /* v(CastExpr) */ /* too many artificial instances of this */ \
+  v(ChooseExpr) \
+  v(DeclRefExpr) /* may be too general, requires excluding constants */ \
+  v(GenericSelectionExpr) \
+  v(LambdaExpr) \
+  v(MaterializeTemporaryExpr) \
+  v(MemberExpr) \
+  v(OpaqueValueExpr) \
+  v(PseudoObjectExpr) \
+  v(UnaryOperator) \
+  v(VAArgExpr) \
+  v(ReturnStmt)
+
+#define VISITOR_METHOD_PRINT(type, var)                                        \
+  PrintRegion(var->getBeginLoc(), var->getEndLoc(), RegionKind::Computation,  \
+              #type, /* beginNextLine = */ false);
+
+// Counts for `-stats`: regions are attributed to the method that last ran,
+// as visitor methods never run inside one another
+#define COUNT_VISIT(type) ++MethodCalls[CurrentMethod = Stats##type];
+
+#define VISITOR_METHOD(type) \
+  bool Visit ## type (type *s) { \
+    COUNT_VISIT(type) \
+    VISITOR_METHOD_PRINT(type, s) \
+    return true; \
+  } /* end VisitExpr */
+
+  STMTS_TO_PRINT(VISITOR_METHOD)
+
+  // Some nodes have non-body subexpressions
+
+  bool VisitDoStmt(DoStmt *s) {
+    COUNT_VISIT(DoStmt)
+    if (const auto *cond = s->getCond()) {
+      VISITOR_METHOD_PRINT(DoStmt.Cond, cond)
+    }
+    return true;
+  }
+
+  bool VisitForStmt(ForStmt *s) {
+    COUNT_VISIT(ForStmt)
+    if (const auto *init = s->getInit()) {
+      VISITOR_METHOD_PRINT(ForStmt.Init, init)
+    }
+    if (const auto *cond = s->getCond()) {
+      VISITOR_METHOD_PRINT(ForStmt.Cond, cond)
+    }
+    if (const auto *inc = s->getInc()) {
+      VISITOR_METHOD_PRINT(ForStmt.Inc, inc)
+    }
+    return true;
+  }
+
+  bool VisitIfStmt(IfStmt *s) {
+    COUNT_VISIT(IfStmt)
+    if (const auto *cond = s->getCond()) {
+      VISITOR_METHOD_PRINT(IfStmt.Cond, cond)
+    }
+    return true;
+  }
+
+  bool VisitSwitchStmt(SwitchStmt *s) {
+    COUNT_VISIT(SwitchStmt)
+    if (const auto *cond = s->getCond()) {
+      VISITOR_METHOD_PRINT(SwitchStmt.Cond, cond)
+    }
+    return true;
+  }
+
+  bool VisitWhileStmt(WhileStmt *s) {
+    COUNT_VISIT(WhileStmt)
+    if (const auto *cond = s->getCond()) {
+      VISITOR_METHOD_PRINT(WhileStmt.Cond, cond)
+    }
+    return true;
+  }
+
+  // Some nodes require customised handling depending on the data they contain
+
+  bool VisitAsmStmt(AsmStmt *s) {
+    COUNT_VISIT(AsmStmt)
+    // Adapts the logic of the `BinaryOperator` case below
+    // to work for inline assembly.
+
+    for (const auto *input : s->inputs()) {
+      ReportTreeAsDefined(input, s, RegionKind::MayBeDefined,
+                          /* beginNextLine = */ false);
+    }
+
+    for (const auto *output : s->outputs()) {
+      ReportTreeAsDefined(output, s, RegionKind::MustBeDefined,
+                          /* beginNextLine = */ true);
+    }
+
+    return true;
+  }
+
+  bool VisitBinaryOperator(BinaryOperator *s) {
+    COUNT_VISIT(BinaryOperator)
+    VISITOR_METHOD_PRINT(BinaryOperator, s)
+
+    if (!s->isAssignmentOp())
+      return true;
+
+    // Consider right-hand side variables as likely to be defined
+    // as of the current line
+    ReportTreeAsDefined(s->getRHS(), s, RegionKind::MayBeDefined,
+                        /* beginNextLine = */ false);
+
+    // Record variable definition region for assignment operations
+    // on the next line _after_ assignment
+    ReportTreeAsDefined(s->getLHS(), s, RegionKind::MustBeDefined,
+                        /* beginNextLine = */ true);
+
+    return true;
+  }
+
+  bool VisitCallExpr(CallExpr *s) {
+    COUNT_VISIT(CallExpr)
+    if (const auto *callee = s->getCallee()) {
+      VISITOR_METHOD_PRINT(CallExpr.Callee, callee)
+    }
+
+    // Arguments shouldn't be examined for computation at this level, as they
+    // may have a whole tree of multi-line computation, so we instead inspect
+    // them further by recursion
+    // llvm::errs() << "Call:\n";
+    // s->dump();
+
+    if (CfgDefinedness || !IsKindEnabled(RegionKind::MayBeDefined))
+      return true;
+
+    // Mark variables used in call arguments as "may be defined" after it
+    // llvm::errs() << "Arguments: " << s->getNumArgs() << "\n";
+    for (const Expr *argument : s->arguments()) {
+      // llvm::errs() << "Argument:\n";
+      // argument->dump();
+      // Descend to `DeclRefExpr` within the argument
+      while (argument && !isa<DeclRefExpr>(argument)) {
+        // Check whether there are any children
+        if (argument->child_begin() == argument->child_end())
+          break;
+        // Only check the first child for simplicity (seems fine for most cases)
+        const Stmt *child = *argument->child_begin();
+        // llvm::errs() << "Argument child:\n";
+        // child->dump();
+        // Ignore non-`Expr` children
+        if (!isa<Expr>(child))
+          break;
+        argument = cast<Expr>(child);
+      }
+      if (!argument || !isa<DeclRefExpr>(argument))
+        continue;
+      const auto *declRefExpr = cast<DeclRefExpr>(argument);
+      // When referencing existing variables like this, assume storage may
+      // already exist on the current line.
+      ReportDeclRefExprAsDefined(declRefExpr, s, RegionKind::MayBeDefined,
+                                 /* beginNextLine = */ false);
+    }
+
+    return true;
+  }
+
+  bool TraverseConstantExpr(ConstantExpr *s) {
+    // Skip constant expressions (e.g. case statements)
+    return true;
+  }
+
+  bool VisitFunctionDecl(FunctionDecl *s) {
+    COUNT_VISIT(FunctionDecl)
+    // We want to mark the opening and closing braces as having computation
+    // Debug info associates the function prologue / epilogue with these lines
+    if (const auto *body = dyn_cast_if_present<CompoundStmt>(s->getBody())) {
+      // Falls back to the lexical analysis if there's no CFG
+      // and doesn't build the CFG when its regions aren't wanted
+      CfgDefinedness =
+          Definedness == DefinednessMode::Cfg &&
+          (!(IsKindEnabled(RegionKind::MustBeDefined) ||
+             IsKindEnabled(RegionKind::MayBeDefined)) ||
+           ReportDefinednessFromCFG(*s));
+
+      // Prologue
+      PrintRegion(body->getBeginLoc(), body->getBeginLoc(),
+                  RegionKind::Computation, "FunctionDecl.Prologue",
+                  /* beginNextLine = */ false);
+
+      // Epilogue
+      PrintRegion(body->getEndLoc(), body->getEndLoc(),
+                  RegionKind::Computation, "FunctionDecl.Epilogue",
+                  /* beginNextLine = */ false);
+
+      for (const auto *param : s->parameters()) {
+        // Record parameter declaration scope
+        // Matches the definition region below, which uses the function body.
+        PrintRegion(body->getBeginLoc(), body->getEndLoc(),
+                    RegionKind::DeclScope, *param,
+                    /* beginNextLine = */ false);
+
+        // Record parameter definition region
+        // Debug info typically reflects parameters as defined starting on the
+        // line with the opening brace of the function body.
+        if (!CfgDefinedness)
+          PrintRegion(body->getBeginLoc(), body->getEndLoc(),
+                      RegionKind::MustBeDefined, *param,
+                      /* beginNextLine = */ false);
+      }
+    }
+    return true;
+  }
+
+  bool VisitVarDecl(VarDecl *s) {
+    COUNT_VISIT(VarDecl)
+    // Only examine local variables inside functions
+    if (!isa<FunctionDecl>(s->getDeclContext()) || !s->isLocalVarDecl())
+      return true;
+
+    const auto *parentDeclStmt = dyn_cast_if_present<DeclStmt>(
+        ParentStmts.empty() ? nullptr : ParentStmts.back());
+    // `VarDecl` should be child of `DeclStmt`
+    assert(parentDeclStmt && "VarDecl not child of DeclStmt");
+    const auto *parentStmt = GetParentStmt(parentDeclStmt);
+    // Only examine variables within some kind of `Stmt`, such as a continuing
+    // `CompoundStmt` or blocks with associated declarations (e.g. `ForStmt`)
+    if (!parentStmt)
+      return true;
+
+    // Record variable declaration scope
+    // Treats the entire enclosing block as potential scope
+    // This allows for e.g. storage on the stack to match the whole block
+    // Note: We currently filter away stack coverage via the definition filter
+    PrintRegion(parentStmt->getBeginLoc(), parentStmt->getEndLoc(),
+                RegionKind::DeclScope, *s,
+                /* beginNextLine = */ false);
+
+    // TODO: Check C++ default initialisation cases
+
+    // `VarDecl` has computation only for automatic locals with an initialiser
+    // Static locals _do not_ have computation (even with an initialiser), as
+    // their "initialisation time" occurs outside the function.
+    if (s->hasInit() && !s->isStaticLocal())
+      VISITOR_METHOD_PRINT(VarDecl, s)
+
+    // Record variable definition region
+    // Debug info typically reflects variables as defined on the line _after_
+    // assignment, so we print the next line here.
+    // Multiple cases are considered as defined:
+    //   - automatic locals with an initialiser
+    //   - static locals (empty initialised when no initialiser present)
+    if ((s->hasInit() || s->isStaticLocal()) && !CfgDefinedness)
+      PrintRegion(s->getEndLoc(), parentStmt->getEndLoc(),
+                  RegionKind::MustBeDefined, *s,
+                  /* beginNextLine = */ true);
+
+    // Consider initialiser variables as likely to be defined
+    // as of the current line
+    if (s->hasInit())
+      ReportTreeAsDefined(s->getInit(), parentDeclStmt, RegionKind::MayBeDefined,
+                          /* beginNextLine = */ false);
+
+    return true;
+  }
+
+  // Visitor methods written out above, rather than from `STMTS_TO_PRINT`
+#define OTHER_VISITOR_METHODS(v) \
+  v(DoStmt) \
+  v(ForStmt) \
+  v(IfStmt) \
+  v(SwitchStmt) \
+  v(WhileStmt) \
+  v(AsmStmt) \
+  v(BinaryOperator) \
+  v(CallExpr) \
+  v(FunctionDecl) \
+  v(VarDecl)
+
+  // Add another visitor's `-stats` counts to ours
+  void AddStats(const DbgCovASTVisitor &other) {
+    for (unsigned method = 0; method < NumStatsMethods; ++method) {
+      MethodCalls[method] += other.MethodCalls[method];
+      for (unsigned kind = 0; kind < dbgcov::NumRegionKinds; ++kind)
+        MethodRegions[method][kind] += other.MethodRegions[method][kind];
+    }
+  }
+
+  // Write the `-stats` table: calls and regions of each kind per method
+  void PrintStats(raw_ostream &OS, StringRef inputName) const {
+    OS << "dbgcov-tool: statistics for " << inputName << "\n";
+    OS << format("  %-32s %10s", "method", "calls");
+    for (unsigned kind = 0; kind < dbgcov::NumRegionKinds; ++kind)
+      OS << format(" %14s",
+                   GetRegionKindName(static_cast<RegionKind>(kind)).data());
+    OS << "\n";
+    uint64_t totalCalls = 0;
+    uint64_t totalRegions[dbgcov::NumRegionKinds] = {};
+    for (unsigned method = 1; method < NumStatsMethods; ++method) {
+      if (!MethodCalls[method])
+        continue;
+      OS << format("  %-32s %10llu", GetStatsMethodName(method),
+                   (unsigned long long)MethodCalls[method]);
+      for (unsigned kind = 0; kind < dbgcov::NumRegionKinds; ++kind) {
+        OS << format(" %14llu",
+                     (unsigned long long)MethodRegions[method][kind]);
+        totalRegions[kind] += MethodRegions[method][kind];
+      }
+      OS << "\n";
+      totalCalls += MethodCalls[method];
+    }
+    OS << format("  %-32s %10llu", "total", (unsigned long long)totalCalls);
+    for (unsigned kind = 0; kind < dbgcov::NumRegionKinds; ++kind)
+      OS << format(" %14llu", (unsigned long long)totalRegions[kind]);
+    OS << "\n";
+  }
+
+private:
+#define STATS_METHOD_ENUMERATOR(type) Stats##type,
+  enum StatsMethod : unsigned {
+    StatsNone,
+    STMTS_TO_PRINT(STATS_METHOD_ENUMERATOR)
+    OTHER_VISITOR_METHODS(STATS_METHOD_ENUMERATOR)
+    NumStatsMethods
+  };
+  static_assert(NumStatsMethods <= 256, "PendingRegion::Method is a byte");
+
+  static const char *GetStatsMethodName(unsigned method) {
+#define STATS_METHOD_NAME(type) "Visit" #type,
+    static const char *const names[NumStatsMethods] = {
+      "(none)",
+      STMTS_TO_PRINT(STATS_METHOD_NAME)
+      OTHER_VISITOR_METHODS(STATS_METHOD_NAME)
+    };
+    return names[method];
+  }
+
+  std::unique_lock<std::mutex> LockSourceManager() {
+    if (!SourceManagerLock)
+      return std::unique_lock<std::mutex>();
+    return std::unique_lock<std::mutex>(*SourceManagerLock);
+  }
+
+  Rewriter &TheRewriter;
+  ASTContext &TheContext;
+  RegionSink *Sink;
+  std::mutex *SourceManagerLock = nullptr;
+  // Non-`Expr` statements enclosing the current traversal position
+  SmallVector<const Stmt *, 32> ParentStmts;
+  // Strings cached for the whole translation unit
+  BumpPtrAllocator StringAlloc;
+  UniqueStringSaver Paths;
+  StringSaver Names;
+  DenseMap<const char *, StringRef> AbsolutePaths;
+  DenseMap<const NamedDecl *, StringRef> ExtendedNames;
+  // Regions awaiting `EmitPendingRegions`, and its scratch space; kept to
+  // reuse their storage
+  std::vector<PendingRegion> Pending;
+  std::vector<std::pair<SourceLocation, unsigned>> PendingLocations;
+  std::vector<ResolvedLocation> Resolved;
+  DenseMap<const NamedDecl *, ResolvedLocation> DeclLocations;
+  // Whether the function being traversed had `-definedness=cfg` applied
+  bool CfgDefinedness = false;
+  // Always counted (it costs next to nothing), but only printed for `-stats`
+  unsigned CurrentMethod = StatsNone;
+  uint64_t MethodCalls[NumStatsMethods] = {};
+  uint64_t MethodRegions[NumStatsMethods][dbgcov::NumRegionKinds] = {};
+};
+
+using PhaseClock = std::chrono::steady_clock;
+
+// Times another sink, for `-phase-timings`
+class TimingRegionSink : public RegionSink {
+public:
+  explicit TimingRegionSink(std::unique_ptr<RegionSink> Next)
+      : Next(std::move(Next)) {}
+  void AddRegion(const dbgcov::Region &region) override {
+    PhaseClock::time_point start = PhaseClock::now();
+    Next->AddRegion(region);
+    InAddRegion += PhaseClock::now() - start;
+    ++NumRegions;
+  }
+  void BeginFunction(StringRef name, StringRef path, unsigned line) override {
+    Next->BeginFunction(name, path, line);
+  }
+  void Finish() override {
+    PhaseClock::time_point start = PhaseClock::now();
+    Next->Finish();
+    InFinish += PhaseClock::now() - start;
+  }
+
+  PhaseClock::duration InAddRegion{};
+  PhaseClock::duration InFinish{};
+  uint64_t NumRegions = 0;
+
+private:
+  std::unique_ptr<RegionSink> Next;
+};
+
+static std::unique_ptr<RegionSink>
+MaybeTimeSink(std::unique_ptr<RegionSink> S) {
+  if (!PhaseTimings)
+    return S;
+  return make_unique<TimingRegionSink>(std::move(S));
+}
+
+// Implementation of the ASTConsumer interface for reading an AST produced
+// by the Clang parser.
+class DbgCovConsumer : public ASTConsumer {
+public:
+  DbgCovConsumer(ASTContext &C, std::unique_ptr<RegionSink> S, StringRef InFile)
+      : R(C.getSourceManager(), C.getLangOpts()),
+        Sink(MaybeTimeSink(std::move(S))), Visitor(R, C, *Sink), C(C),
+        InputName(InFile.str()) {
+    if (PhaseTimings) {
+      Timing = static_cast<TimingRegionSink *>(Sink.get());
+      StartTime = PhaseClock::now();
+    }
+    if (IncrementalCache.empty())
+      return;
+    Incremental = make_unique<dbgcov::FunctionRegionCache>();
+    if (Error error = Incremental->Load(IncrementalCache)) {
+      // Start afresh; the cache is rewritten at the end
+      llvm::errs() << "Warning: " << toString(std::move(error)) << "\n";
+      Incremental = make_unique<dbgcov::FunctionRegionCache>();
+    }
+  }
+  // Override the method that gets called for each parsed top-level
+  // declaration.
+  bool HandleTopLevelDecl(DeclGroupRef DR) override {
+    //llvm::errs() << "== Saw top-level decl\n";
+    PhaseClock::time_point start;
+    if (Timing)
+      start = PhaseClock::now();
+    HandlePrecompiledDecls();
+    for (DeclGroupRef::iterator b = DR.begin(), e = DR.end(); b != e; ++b) {
+      //(*b)->dump();
+      HandleDecl(*b);
+    }
+    if (Timing)
+      InTopLevelDecls += PhaseClock::now() - start;
+    return true;
+  }
+
+  void HandleTranslationUnit(ASTContext &Ctx) override {
+    // In case the source has nothing after its precompiled prefix
+    HandlePrecompiledDecls();
+    if (!Deferred.empty()) {
+      PhaseClock::time_point start;
+      if (Timing)
+        start = PhaseClock::now();
+      TraverseInParallel();
+      if (Timing)
+        InTopLevelDecls += PhaseClock::now() - start;
+    }
+    {
+      llvm::TimeTraceScope traceScope("DbgCov output", InputName);
+      Sink->Finish();
+    }
+    if (Incremental) {
+      // The output is complete either way; the next run will just redo more
+      if (Error error = Incremental->Save(IncrementalCache))
+        llvm::errs() << "Warning: " << toString(std::move(error)) << "\n";
+    }
+    if (Timing)
+      ReportPhaseTimings();
+    if (AreStatisticsEnabled()) {
+      // In one piece, as batch mode's threads share stderr
+      std::string stats;
+      raw_string_ostream stream(stats);
+      for (const auto &worker : Workers)
+        Visitor.AddStats(*worker);
+      Visitor.PrintStats(stream, InputName);
+      if (Incremental)
+        stream << format("  incremental cache: %u functions replayed "
+                         "(%u moved), %u analysed\n",
+                         Incremental->GetReplayedCount(),
+                         Incremental->GetShiftedCount(),
+                         Incremental->GetAddedCount());
+      llvm::errs() << stream.str();
+    }
+  }
+
+  // Only consulted by the parser when `SkipFunctionBodies` is set, which we
+  // do for `-header-functions=skip`
+  bool shouldSkipFunctionBody(Decl *D) override {
+    return HeaderFunctions == HeaderFunctionMode::Skip &&
+           IsInHeader(D->getLocation());
+  }
+
+private:
+  void HandleDecl(Decl *D) {
+    if (!ShouldTraverse(D))
+      return;
+    if (IsParallel()) {
+      Deferred.push_back(D);
+      return;
+    }
+
+    llvm::TimeTraceScope traceScope("DbgCov traverse", [&]() {
+      const auto *namedDecl = dyn_cast<NamedDecl>(D);
+      return namedDecl ? namedDecl->getNameAsString() : std::string();
+    });
+
+    BeginFunction(D);
+    if (Incremental && TraverseIncrementally(D))
+      return;
+
+    // Traverse the declaration using our AST visitor
+    Visitor.TraverseDecl(D);
+    Visitor.EmitPendingRegions();
+  }
+
+  /* For `-traverse-jobs`: the top-level declarations are collected as they
+   * are parsed, and traversed once the AST is complete (and no longer
+   * changing), each by one of a pool of threads with its own visitor. Region
+   * locations are resolved under a lock, as the `SourceManager` caches its
+   * lookups, and the regions built outside it into a buffer for each
+   * declaration; the buffers are then sent to the sink in source order, so
+   * the output is just as if traversed sequentially.
+   *
+   * Building CFGs allocates in the `ASTContext`, and declarations from a PCH
+   * are deserialized lazily, so those cases (like the incremental cache,
+   * which replays as it goes) stay sequential.
+   */
+  bool IsParallel() const {
+    return TraverseJobs != 1 && Definedness != DefinednessMode::Cfg &&
+           !Incremental && !C.getExternalSource();
+  }
+
+  // Keeps regions for sending on later
+  class BufferRegionSink : public RegionSink {
+  public:
+    void AddRegion(const dbgcov::Region &region) override {
+      Buffer->push_back(region);
+    }
+    std::vector<dbgcov::Region> *Buffer = nullptr;
+  };
+
+  void TraverseInParallel() {
+    llvm::TimeTraceScope traceScope("DbgCov parallel traverse", InputName);
+    std::vector<std::vector<dbgcov::Region>> buffers(Deferred.size());
+    unsigned numThreads = TraverseJobs;
+    if (!numThreads)
+      numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads = std::min<size_t>(numThreads, Deferred.size());
+    // Region strings belong to the visitor that found them, so all of them
+    // are kept until the sink is done
+    std::vector<BufferRegionSink> sinks(numThreads);
+    for (unsigned i = 0; i < numThreads; ++i) {
+      Workers.push_back(make_unique<DbgCovASTVisitor>(R, C, sinks[i]));
+      Workers.back()->SetSourceManagerLock(SourceManagerLock);
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&](unsigned index) {
+      DbgCovASTVisitor &visitor = *Workers[index];
+      for (size_t i; (i = next++) < Deferred.size();) {
+        sinks[index].Buffer = &buffers[i];
+        visitor.TraverseDecl(Deferred[i]);
+        visitor.EmitPendingRegions();
+      }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < numThreads; ++i)
+      threads.emplace_back(worker, i);
+    for (auto &thread : threads)
+      thread.join();
+
+    for (size_t i = 0; i < Deferred.size(); ++i) {
+      BeginFunction(Deferred[i]);
+      for (const auto &region : buffers[i])
+        Sink->AddRegion(region);
+    }
+    Deferred.clear();
+  }
+
+  // Tell the sink which function (if any) the next regions belong to
+  void BeginFunction(const Decl *D) {
+    const auto *functionDecl = dyn_cast<FunctionDecl>(D);
+    if (!functionDecl || !functionDecl->doesThisDeclarationHaveABody() ||
+        !Visitor.IsFunctionSelected(*functionDecl)) {
+      Sink->BeginFunction(StringRef(), StringRef(), 0);
+      return;
+    }
+    const auto &mgr = C.getSourceManager();
+    PresumedLoc pLoc =
+        mgr.getPresumedLoc(mgr.getExpansionLoc(functionDecl->getBeginLoc()));
+    if (pLoc.isInvalid()) {
+      Sink->BeginFunction(StringRef(), StringRef(), 0);
+      return;
+    }
+    Sink->BeginFunction(functionDecl->getNameAsString(),
+                        Visitor.GetAbsolutePath(pLoc), pLoc.getLine());
+  }
+
+  // With `-pch-dir`, the declarations of the source's prefix come from the
+  // PCH and never reach `HandleTopLevelDecl`. Traverse them before anything
+  // parsed after them, which is where they would be in preprocessed input.
+  void HandlePrecompiledDecls() {
+    if (SeenPrecompiledDecls)
+      return;
+    SeenPrecompiledDecls = true;
+    if (!C.getExternalSource())
+      return;
+    // Loading function bodies can load more declarations, so copy the list
+    SmallVector<Decl *, 256> decls;
+    for (Decl *D : C.getTranslationUnitDecl()->decls())
+      if (D->isFromASTFile())
+        decls.push_back(D);
+    for (Decl *D : decls)
+      HandleDecl(D);
+  }
+
+  // Whether `loc` was included from another file. For preprocessed input this
+  // comes from the line markers' flags, which are recorded in the line table.
+  bool IsInHeader(SourceLocation loc) {
+    const auto &mgr = C.getSourceManager();
+    loc = mgr.getExpansionLoc(loc);
+    if (mgr.isInSystemHeader(loc))
+      return true;
+    PresumedLoc pLoc = mgr.getPresumedLoc(loc);
+    return pLoc.isValid() && pLoc.getIncludeLoc().isValid();
+  }
+
+  bool ShouldTraverse(const Decl *D) {
+    if (HeaderFunctions == HeaderFunctionMode::All)
+      return true;
+    const auto *functionDecl = dyn_cast<FunctionDecl>(D);
+    if (!functionDecl || !functionDecl->doesThisDeclarationHaveABody() ||
+        !IsInHeader(functionDecl->getLocation()))
+      return true;
+    if (HeaderFunctions == HeaderFunctionMode::Skip)
+      return false;
+    // Don't claim functions the filters will skip, so another translation
+    // unit (with other filters) can still report them
+    if (!Visitor.IsFunctionSelected(*functionDecl))
+      return false;
+    return ClaimHeaderFunction(*functionDecl);
+  }
+
+  // The source file of this translation unit: the presumed file of the
+  // outermost `#include` leading to `pLoc`. Unlike the file we were given,
+  // which may be a temporary copy, it's the same each time the unit is built.
+  StringRef GetMainSourcePath(PresumedLoc pLoc) {
+    const auto &mgr = C.getSourceManager();
+    while (pLoc.getIncludeLoc().isValid()) {
+      PresumedLoc includer = mgr.getPresumedLoc(pLoc.getIncludeLoc());
+      if (includer.isInvalid())
+        break;
+      pLoc = includer;
+    }
+    return Visitor.GetAbsolutePath(pLoc);
+  }
+
+  // For `-header-functions=once`: atomically create an index entry named by
+  // the function's file, line and body text, holding the main source file of
+  // the translation unit that creates it first. That unit is the one that
+  // analyses the function, including when it alone is rebuilt later.
+  bool ClaimHeaderFunction(const FunctionDecl &functionDecl) {
+    const auto &mgr = C.getSourceManager();
+    SourceLocation loc = mgr.getExpansionLoc(functionDecl.getLocation());
+    PresumedLoc pLoc = mgr.getPresumedLoc(loc);
+    if (pLoc.isInvalid())
+      return true;
+
+    MD5 hash;
+    hash.update(Visitor.GetAbsolutePath(pLoc));
+    hash.update(StringRef("", 1));
+    hash.update(std::to_string(pLoc.getLine()));
+    hash.update(StringRef("", 1));
+    const Stmt *body = functionDecl.getBody();
+    if (!body)
+      return true;
+    SourceLocation bodyBegin = mgr.getExpansionLoc(body->getBeginLoc());
+    SourceLocation bodyEnd = mgr.getExpansionLoc(body->getEndLoc());
+    if (mgr.getFileID(bodyBegin) == mgr.getFileID(bodyEnd)) {
+      const char *begin = mgr.getCharacterData(bodyBegin);
+      // The end location is the start of the closing brace
+      const char *end = mgr.getCharacterData(bodyEnd) + 1;
+      hash.update(StringRef(begin, end - begin));
+    }
+    MD5::MD5Result result;
+    hash.final(result);
+
+    SmallString<128> entryPath(HeaderIndex);
+    llvm::sys::path::append(entryPath, result.digest());
+    int fd;
+    StringRef owner = GetMainSourcePath(pLoc);
+    std::error_code error = llvm::sys::fs::openFileForWrite(
+        entryPath, fd, llvm::sys::fs::CD_CreateNew);
+    if (error == std::errc::file_exists) {
+      // A unit racing us may not have written its name yet, but then it
+      // isn't us either
+      auto entry = MemoryBuffer::getFile(entryPath);
+      return entry && (*entry)->getBuffer() == owner;
+    }
+    if (error) {
+      // Better to emit duplicates than to lose the function
+      llvm::errs() << "Warning: " << entryPath << ": " << error.message()
+                   << "\n";
+      return true;
+    }
+    raw_fd_ostream entry(fd, /*shouldClose=*/true);
+    entry << owner;
+    return true;
+  }
+
+  // For `-incremental-cache`: replay the regions of a function definition
+  // unchanged since the last run, or else traverse it and record its regions
+  // for next time. Returns false for anything we can't fingerprint.
+  bool TraverseIncrementally(Decl *D) {
+    const auto *functionDecl = dyn_cast<FunctionDecl>(D);
+    if (!functionDecl || !functionDecl->doesThisDeclarationHaveABody())
+      return false;
+    unsigned startLine;
+    std::string fingerprint = FingerprintFunction(*functionDecl, startLine);
+    if (fingerprint.empty())
+      return false;
+    if (Incremental->Replay(fingerprint, startLine, *Sink))
+      return true;
+
+    dbgcov::RecordingRegionSink recorder(*Sink);
+    Visitor.SetSink(recorder);
+    Visitor.TraverseDecl(D);
+    Visitor.EmitPendingRegions();
+    Visitor.SetSink(*Sink);
+    Incremental->Add(fingerprint, startLine, recorder.TakeRecorded());
+    return true;
+  }
+
+  /* Everything a function's regions depend on, except the line it starts on
+   * (returned in `startLine`), which only shifts them:
+   *  - its text, which includes any line markers within it;
+   *  - its file and starting column;
+   *  - the shape of its AST, since the same text can parse differently
+   *    depending on declarations elsewhere (`(T)*p` is a cast only if `T`
+   *    names a type).
+   * Returns an empty string if the function's text isn't contiguous.
+   */
+  std::string FingerprintFunction(const FunctionDecl &functionDecl,
+                                  unsigned &startLine) {
+    const auto &mgr = C.getSourceManager();
+    SourceLocation begin = mgr.getExpansionLoc(functionDecl.getBeginLoc());
+    SourceLocation end = mgr.getExpansionLoc(functionDecl.getEndLoc());
+    PresumedLoc pLoc = mgr.getPresumedLoc(begin);
+    if (pLoc.isInvalid() || mgr.getFileID(begin) != mgr.getFileID(end) ||
+        mgr.getFileOffset(end) < mgr.getFileOffset(begin))
+      return std::string();
+    startLine = pLoc.getLine();
+
+    MD5 hash;
+    hash.update(Visitor.GetAbsolutePath(pLoc));
+    hash.update(StringRef("", 1));
+    hash.update(std::to_string(pLoc.getColumn()));
+    hash.update(StringRef("", 1));
+    // Regions also depend on the analysis options
+    hash.update(std::to_string(static_cast<int>(Definedness.getValue())));
+    hash.update(StringRef("", 1));
+    hash.update(FunctionFilter);
+    hash.update(StringRef("", 1));
+    for (const auto &filter : LineFilter) {
+      hash.update(filter);
+      hash.update(StringRef("", 1));
+    }
+    hash.update(std::to_string(EnabledKinds));
+    hash.update(StringRef("", 1));
+    const char *text = mgr.getCharacterData(begin);
+    // The end location is the start of the closing brace
+    hash.update(StringRef(text, mgr.getCharacterData(end) + 1 - text));
+
+    SmallVector<const Stmt *, 32> workQueue;
+    workQueue.push_back(functionDecl.getBody());
+    while (!workQueue.empty()) {
+      const Stmt *node = workQueue.pop_back_val();
+      // Absent children (e.g. a `for` with no condition) count too
+      uint8_t bytes[2] = {0, 0};
+      if (node) {
+        unsigned stmtClass = node->getStmtClass() + 1;
+        bytes[0] = uint8_t(stmtClass);
+        bytes[1] = uint8_t(stmtClass >> 8);
+        for (const Stmt *child : node->children())
+          workQueue.push_back(child);
+      }
+      hash.update(bytes);
+    }
+
+    MD5::MD5Result result;
+    hash.final(result);
+    return result.digest().str().str();
+  }
+
+  // Everything outside our own `HandleTopLevelDecl` counts as parsing
+  // (including Sema); region output is taken out of the traversal time.
+  void ReportPhaseTimings() {
+    using Seconds = std::chrono::duration<double>;
+    PhaseClock::duration total = PhaseClock::now() - StartTime;
+    PhaseClock::duration emission = Timing->InAddRegion + Timing->InFinish;
+    PhaseClock::duration traversal = InTopLevelDecls - Timing->InAddRegion;
+    PhaseClock::duration parse = total - InTopLevelDecls - Timing->InFinish;
+    llvm::errs() << format("dbgcov-tool: phase timings for %s: parse %.6fs "
+                           "traversal %.6fs emission %.6fs regions %llu\n",
+                           InputName.c_str(), Seconds(parse).count(),
+                           Seconds(traversal).count(),
+                           Seconds(emission).count(),
+                           (unsigned long long)Timing->NumRegions);
+  }
+
+private:
+  // Before `Visitor`, which uses it
+  Rewriter R;
+  std::unique_ptr<RegionSink> Sink;
+  DbgCovASTVisitor Visitor;
+  ASTContext &C;
+  std::unique_ptr<dbgcov::FunctionRegionCache> Incremental;
+  std::string InputName;
+  // Only for `-phase-timings`
+  TimingRegionSink *Timing = nullptr;
+  PhaseClock::time_point StartTime;
+  PhaseClock::duration InTopLevelDecls{};
+  bool SeenPrecompiledDecls = false;
+  // Only for `-traverse-jobs`
+  std::vector<Decl *> Deferred;
+  std::vector<std::unique_ptr<DbgCovASTVisitor>> Workers;
+  std::mutex SourceManagerLock;
+};
+
+// A sink writing the `-output-format` to `OS`
+static std::unique_ptr<RegionSink> CreateFormatSink(raw_ostream &OS) {
+  switch (Format) {
+  case OutputFormat::Text:
+    break;
+  case OutputFormat::Binary:
+    return make_unique<dbgcov::BinaryRegionSink>(OS);
+  case OutputFormat::Summary:
+    return make_unique<dbgcov::FunctionSummarySink>(OS);
+  }
+  return make_unique<dbgcov::TextRegionSink>(OS);
+}
+
+// Compresses the output of another sink, in the `-output-format`
+class CompressedRegionSink : public RegionSink {
+public:
+  CompressedRegionSink(raw_ostream &OS, dbgcov::Compression compression)
+      : Compressed(OS, compression), Next(CreateFormatSink(Compressed)) {}
+  void AddRegion(const dbgcov::Region &region) override {
+    Next->AddRegion(region);
+  }
+  void BeginFunction(StringRef name, StringRef path, unsigned line) override {
+    Next->BeginFunction(name, path, line);
+  }
+  void Finish() override {
+    Next->Finish();
+    Compressed.Finish();
+  }
+
+private:
+  dbgcov::CompressingOStream Compressed;
+  std::unique_ptr<RegionSink> Next;
+};
+
+Error PrepareAnalysis() {
+  if (Error error = ParseFilters())
+    return error;
+  if (!dbgcov::IsCompressionAvailable(Compress))
+    return createStringError(inconvertibleErrorCode(),
+                             "-compress=%s: LLVM was built without it",
+                             dbgcov::GetCompressionName(Compress));
+  if (HeaderFunctions != HeaderFunctionMode::Once)
+    return Error::success();
+  if (HeaderIndex.empty())
+    return createStringError(inconvertibleErrorCode(),
+                             "-header-functions=once needs -header-index");
+  if (std::error_code error = llvm::sys::fs::create_directories(HeaderIndex))
+    return createStringError(error, "%s: %s", HeaderIndex.c_str(),
+                             error.message().c_str());
+  return Error::success();
+}
+
+Error dbgcov::SetAnalysisOptions(const std::vector<std::string> &options) {
+  auto &registered = llvm::cl::getRegisteredOptions();
+  // Start again from the defaults: the plugin sets the options for each
+  // translation unit, and one process may compile several
+  for (auto &entry : registered)
+    if (is_contained(entry.second->Categories, &DbgCovCategory))
+      entry.second->reset();
+  for (const auto &option : options) {
+    StringRef name, value;
+    std::tie(name, value) = StringRef(option).split('=');
+    auto found = registered.find(name);
+    if (found == registered.end() ||
+        !is_contained(found->second->Categories, &DbgCovCategory))
+      return createStringError(inconvertibleErrorCode(),
+                               "unknown option '%s'", name.str().c_str());
+    // Prints the details itself
+    if (found->second->addOccurrence(0, name, value))
+      return createStringError(inconvertibleErrorCode(),
+                               "invalid option '%s'", option.c_str());
+  }
+  return PrepareAnalysis();
+}
+
+std::unique_ptr<RegionSink> CreateRegionSink(raw_ostream &OS) {
+  std::unique_ptr<RegionSink> sink;
+  if (Compress != dbgcov::Compression::None)
+    sink = make_unique<CompressedRegionSink>(OS, Compress);
+  else
+    sink = CreateFormatSink(OS);
+  if (Canonical)
+    sink = make_unique<dbgcov::CanonicalRegionSink>(std::move(sink));
+  if (OutputThread)
+    sink = make_unique<dbgcov::AsyncRegionSink>(std::move(sink));
+  return sink;
+}
+
+std::unique_ptr<ASTConsumer>
+CreateDbgCovConsumer(CompilerInstance &CI, std::unique_ptr<RegionSink> sink,
+                     StringRef file) {
+  return make_unique<DbgCovConsumer>(CI.getASTContext(), std::move(sink), file);
+}
@@ -0,0 +1,68 @@
+#ifndef DBGCOV_ANALYSIS_H
+#define DBGCOV_ANALYSIS_H
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "clang/AST/ASTConsumer.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "compressed-output.h"
+#include "regions.h"
+
+/* The analysis itself, shared by `libdbgcov` (and `dbgcov-tool` over it),
+ * which parses its inputs itself, and the Clang plugin, which runs alongside a
+ * real compile. This is the internal interface; see `libdbgcov.h` for the one
+ * for other programs.
+ *
+ * Its options are ordinary LLVM command-line options in `DbgCovCategory`,
+ * set from the tool's command line or the plugin's arguments.
+ */
+
+extern llvm::cl::OptionCategory DbgCovCategory;
+
+enum class OutputFormat { Text, Binary, Summary };
+enum class HeaderFunctionMode { All, Skip, Once };
+enum class DefinednessMode { Lexical, Cfg };
+
+extern llvm::cl::opt<OutputFormat> Format;
+extern llvm::cl::opt<dbgcov::Compression> Compress;
+extern llvm::cl::opt<HeaderFunctionMode> HeaderFunctions;
+extern llvm::cl::opt<std::string> HeaderIndex;
+extern llvm::cl::opt<DefinednessMode> Definedness;
+extern llvm::cl::opt<std::string> IncrementalCache;
+extern llvm::cl::opt<bool> PhaseTimings;
+
+// Check the options, and set up what they need, once all are set
+llvm::Error PrepareAnalysis();
+
+// A sink writing regions to `OS` in the `-output-format`, compressed with
+// `-compress` and coalesced with `-canonical`
+std::unique_ptr<dbgcov::RegionSink> CreateRegionSink(llvm::raw_ostream &OS);
+
+// A consumer sending the regions of the translation unit `CI` is about to
+// parse (from `file`) to `sink`
+std::unique_ptr<clang::ASTConsumer>
+CreateDbgCovConsumer(clang::CompilerInstance &CI,
+                     std::unique_ptr<dbgcov::RegionSink> sink,
+                     llvm::StringRef file);
+
+using RegionSinkFactory = std::function<std::unique_ptr<dbgcov::RegionSink>()>;
+
+namespace clang {
+namespace tooling {
+class FrontendActionFactory;
+}
+} // namespace clang
+
+// For a `ClangTool`: actions parsing each input and sending its regions to a
+// new sink from `createSink` (part of `libdbgcov`, not the plugin)
+std::unique_ptr<clang::tooling::FrontendActionFactory>
+CreateDbgCovActionFactory(RegionSinkFactory createSink);
+
+#endif
@@ -0,0 +1,125 @@
+#include "async-output.h"
+
+#include <algorithm>
+
+#include "llvm/Support/MathExtras.h"
+
+using namespace llvm;
+
+namespace dbgcov {
+
+// Times to yield before going to sleep on a full or empty ring. Sleeping and
+// waking cost a system call each, which is much more than the usual wait.
+static const unsigned SpinLimit = 64;
+// How many records the writer drains before freeing up their space
+static const size_t ReleaseBatch = 256;
+
+AsyncRegionSink::AsyncRegionSink(std::unique_ptr<RegionSink> Next,
+                                 size_t capacity)
+    : Next(std::move(Next)), Ring(PowerOf2Ceil(std::max<size_t>(capacity, 2))),
+      Mask(Ring.size() - 1), Names(Alloc) {
+  Writer = std::thread([this] { Drain(); });
+}
+
+AsyncRegionSink::~AsyncRegionSink() { Stop(); }
+
+void AsyncRegionSink::AddRegion(const Region &region) {
+  Record record{};
+  record.IsRegion = true;
+  record.Data = region;
+  Push(record);
+}
+
+void AsyncRegionSink::BeginFunction(StringRef name, StringRef path,
+                                    unsigned line) {
+  Record record{};
+  record.IsRegion = false;
+  record.Data.Path = path;
+  record.Data.Detail = name.empty() ? StringRef() : Names.save(name);
+  record.Data.BeginLine = line;
+  Push(record);
+}
+
+void AsyncRegionSink::Finish() {
+  Stop();
+  Next->Finish();
+}
+
+void AsyncRegionSink::Push(const Record &record) {
+  size_t head = Head.load(std::memory_order_relaxed);
+  auto isFull = [&] {
+    return head - Tail.load(std::memory_order_acquire) == Ring.size();
+  };
+  for (unsigned spin = 0; isFull(); ++spin) {
+    if (spin < SpinLimit) {
+      std::this_thread::yield();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(Mutex);
+    ProducerWaiting.store(true);
+    Wakeup.wait(lock, [&] { return !isFull(); });
+    ProducerWaiting.store(false);
+  }
+  Ring[head & Mask] = record;
+  // Sequentially consistent, as is the writer's `ConsumerWaiting` store, so
+  // that either we see it is waiting or it sees the new record
+  Head.store(head + 1);
+  if (ConsumerWaiting.load()) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Wakeup.notify_all();
+  }
+}
+
+void AsyncRegionSink::Drain() {
+  size_t tail = Tail.load(std::memory_order_relaxed);
+  auto release = [&] {
+    Tail.store(tail);
+    if (ProducerWaiting.load()) {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Wakeup.notify_all();
+    }
+  };
+  for (unsigned spin = 0;;) {
+    // `Closed` is set after the last record is pushed, so check it first
+    bool closed = Closed.load();
+    size_t head = Head.load();
+    if (head == tail) {
+      if (closed)
+        return;
+      if (spin++ < SpinLimit) {
+        std::this_thread::yield();
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(Mutex);
+      ConsumerWaiting.store(true);
+      Wakeup.wait(lock, [&] { return Head.load() != tail || Closed.load(); });
+      ConsumerWaiting.store(false);
+      continue;
+    }
+    spin = 0;
+    while (tail != head) {
+      const Record &record = Ring[tail & Mask];
+      if (record.IsRegion)
+        Next->AddRegion(record.Data);
+      else
+        Next->BeginFunction(record.Data.Detail, record.Data.Path,
+                            record.Data.BeginLine);
+      if (++tail % ReleaseBatch == 0)
+        release();
+    }
+    release();
+  }
+}
+
+void AsyncRegionSink::Stop() {
+  if (!Writer.joinable())
+    return;
+  Closed.store(true);
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Wakeup.notify_all();
+  }
+  Writer.join();
+}
+
+} // namespace dbgcov
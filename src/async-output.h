@@ -0,0 +1,74 @@
+#ifndef DBGCOV_ASYNC_OUTPUT_H
+#define DBGCOV_ASYNC_OUTPUT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/StringSaver.h"
+
+#include "regions.h"
+
+namespace dbgcov {
+
+/* `-output-thread`: passes regions on to another sink from a thread of its
+ * own, so that formatting, compression and writing overlap with parsing and
+ * traversal. Regions are copied as fixed-size records into a ring buffer with
+ * a single producer (whoever calls `AddRegion`) and a single consumer (the
+ * writer thread), which drains it a batch at a time. Either side only sleeps
+ * when the ring is full or empty.
+ *
+ * Region strings already outlive their sink, so records just point at them;
+ * function names given to `BeginFunction` need not, and are copied.
+ */
+class AsyncRegionSink : public RegionSink {
+public:
+  // `capacity` is in records, and rounded up to a power of two
+  explicit AsyncRegionSink(std::unique_ptr<RegionSink> Next,
+                           size_t capacity = 1 << 14);
+  ~AsyncRegionSink() override;
+
+  void AddRegion(const Region &region) override;
+  void BeginFunction(llvm::StringRef name, llvm::StringRef path,
+                     unsigned line) override;
+  // Waits for the writer to catch up, then finishes the next sink (on the
+  // calling thread)
+  void Finish() override;
+
+private:
+  struct Record {
+    // Otherwise `BeginFunction`, with the name in `Detail` and line in
+    // `BeginLine`
+    bool IsRegion;
+    Region Data;
+  };
+
+  void Push(const Record &record);
+  void Drain();
+  void Stop();
+
+  std::unique_ptr<RegionSink> Next;
+  std::vector<Record> Ring;
+  size_t Mask;
+  // Counts of records ever pushed and popped, on separate cache lines
+  alignas(64) std::atomic<size_t> Head{0};
+  alignas(64) std::atomic<size_t> Tail{0};
+  alignas(64) std::atomic<bool> ProducerWaiting{false};
+  std::atomic<bool> ConsumerWaiting{false};
+  std::atomic<bool> Closed{false};
+  std::mutex Mutex;
+  std::condition_variable Wakeup;
+  std::thread Writer;
+  // Only used by the producer
+  llvm::BumpPtrAllocator Alloc;
+  llvm::UniqueStringSaver Names;
+};
+
+} // namespace dbgcov
+
+#endif
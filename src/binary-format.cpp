@@ -0,0 +1,191 @@
+#include "binary-format.h"
+
+#include <cstring>
+
+#include "llvm/Support/LEB128.h"
+
+using namespace llvm;
+
+namespace dbgcov {
+
+static void WriteUInt32LE(raw_ostream &OS, uint32_t value) {
+  char bytes[4] = {
+    static_cast<char>(value),
+    static_cast<char>(value >> 8),
+    static_cast<char>(value >> 16),
+    static_cast<char>(value >> 24),
+  };
+  OS.write(bytes, sizeof(bytes));
+}
+
+static uint32_t ReadUInt32LE(const uint8_t *bytes) {
+  return uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 |
+         uint32_t(bytes[2]) << 16 | uint32_t(bytes[3]) << 24;
+}
+
+static const size_t HeaderSize = sizeof(BinaryMagic) + 3 * sizeof(uint32_t);
+
+bool IsBinaryRegionData(StringRef data) {
+  return data.size() >= sizeof(BinaryMagic) &&
+         !memcmp(data.data(), BinaryMagic, sizeof(BinaryMagic));
+}
+
+uint32_t BinaryRegionSink::GetStringIndex(StringRef str) {
+  auto inserted = StringIndices.insert(std::make_pair(str, Strings.size()));
+  if (inserted.second)
+    Strings.push_back(inserted.first->getKey());
+  return inserted.first->getValue();
+}
+
+void BinaryRegionSink::AddRegion(const Region &region) {
+  raw_svector_ostream stream(Records);
+  stream << static_cast<char>(region.Kind);
+  encodeULEB128(GetStringIndex(region.Path), stream);
+  encodeULEB128(GetStringIndex(region.Detail), stream);
+  encodeSLEB128(int64_t(region.BeginLine) - int64_t(LastBeginLine), stream);
+  encodeULEB128(region.BeginColumn, stream);
+  assert(region.EndLine >= region.BeginLine && "Region ends before it begins");
+  encodeULEB128(region.EndLine - region.BeginLine, stream);
+  encodeULEB128(region.EndColumn, stream);
+  LastBeginLine = region.BeginLine;
+  ++NumRegions;
+}
+
+void BinaryRegionSink::Finish() {
+  OS.write(BinaryMagic, sizeof(BinaryMagic));
+  WriteUInt32LE(OS, BinaryVersion);
+  WriteUInt32LE(OS, Strings.size());
+  WriteUInt32LE(OS, NumRegions);
+  for (StringRef str : Strings) {
+    encodeULEB128(str.size(), OS);
+    OS << str;
+  }
+  OS.write(Records.data(), Records.size());
+
+  // Ready for another translation unit
+  StringIndices.clear();
+  Strings.clear();
+  Records.clear();
+  NumRegions = 0;
+  LastBeginLine = 0;
+}
+
+namespace {
+
+// Bounds-checked cursor over one section
+class Decoder {
+public:
+  Decoder(const uint8_t *pos, const uint8_t *end) : Pos(pos), End(end) {}
+
+  uint64_t ReadULEB128() {
+    unsigned length = 0;
+    const char *error = nullptr;
+    uint64_t value = decodeULEB128(Pos, &length, End, &error);
+    Advance(length, error);
+    return value;
+  }
+
+  int64_t ReadSLEB128() {
+    unsigned length = 0;
+    const char *error = nullptr;
+    int64_t value = decodeSLEB128(Pos, &length, End, &error);
+    Advance(length, error);
+    return value;
+  }
+
+  uint8_t ReadByte() {
+    if (Pos == End) {
+      Failure = "unexpected end of data";
+      return 0;
+    }
+    return *Pos++;
+  }
+
+  StringRef ReadString() {
+    uint64_t length = ReadULEB128();
+    if (Failure)
+      return StringRef();
+    if (length > uint64_t(End - Pos)) {
+      Failure = "string runs past end of data";
+      return StringRef();
+    }
+    StringRef str(reinterpret_cast<const char *>(Pos), length);
+    Pos += length;
+    return str;
+  }
+
+  const uint8_t *Pos;
+  const uint8_t *End;
+  const char *Failure = nullptr;
+
+private:
+  void Advance(unsigned length, const char *error) {
+    if (error && !Failure)
+      Failure = error;
+    Pos += length;
+  }
+};
+
+} // namespace
+
+Error ReadBinaryRegions(StringRef data,
+                        function_ref<void(const Region &)> callback) {
+  const auto *pos = reinterpret_cast<const uint8_t *>(data.begin());
+  const auto *end = reinterpret_cast<const uint8_t *>(data.end());
+  std::vector<StringRef> strings;
+
+  while (pos != end) {
+    size_t offset = pos - reinterpret_cast<const uint8_t *>(data.begin());
+    if (size_t(end - pos) < HeaderSize ||
+        memcmp(pos, BinaryMagic, sizeof(BinaryMagic)))
+      return createStringError(inconvertibleErrorCode(),
+                               "bad section header at offset %zu", offset);
+    pos += sizeof(BinaryMagic);
+    uint32_t version = ReadUInt32LE(pos);
+    uint32_t numStrings = ReadUInt32LE(pos + 4);
+    uint32_t numRegions = ReadUInt32LE(pos + 8);
+    pos += 3 * sizeof(uint32_t);
+    if (version != BinaryVersion)
+      return createStringError(inconvertibleErrorCode(),
+                               "unsupported format version %u at offset %zu",
+                               version, offset);
+
+    Decoder decoder(pos, end);
+    strings.clear();
+    for (uint32_t i = 0; i < numStrings && !decoder.Failure; ++i)
+      strings.push_back(decoder.ReadString());
+
+    unsigned lastBeginLine = 0;
+    for (uint32_t i = 0; i < numRegions && !decoder.Failure; ++i) {
+      Region region;
+      uint8_t kind = decoder.ReadByte();
+      uint64_t pathIndex = decoder.ReadULEB128();
+      uint64_t detailIndex = decoder.ReadULEB128();
+      region.BeginLine = lastBeginLine + decoder.ReadSLEB128();
+      region.BeginColumn = decoder.ReadULEB128();
+      region.EndLine = region.BeginLine + decoder.ReadULEB128();
+      region.EndColumn = decoder.ReadULEB128();
+      if (decoder.Failure)
+        break;
+      if (kind >= NumRegionKinds || pathIndex >= strings.size() ||
+          detailIndex >= strings.size()) {
+        decoder.Failure = "invalid region record";
+        break;
+      }
+      region.Kind = static_cast<RegionKind>(kind);
+      region.Path = strings[pathIndex];
+      region.Detail = strings[detailIndex];
+      lastBeginLine = region.BeginLine;
+      callback(region);
+    }
+
+    if (decoder.Failure)
+      return createStringError(inconvertibleErrorCode(),
+                               "%s in section at offset %zu", decoder.Failure,
+                               offset);
+    pos = decoder.Pos;
+  }
+  return Error::success();
+}
+
+} // namespace dbgcov
@@ -0,0 +1,69 @@
+#ifndef DBGCOV_BINARY_FORMAT_H
+#define DBGCOV_BINARY_FORMAT_H
+
+#include <cstdint>
+#include <vector>
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "regions.h"
+
+/* Compact binary `.dbgcov` format.
+ *
+ * A file is one or more translation unit sections back to back, each of
+ *
+ *   header:       magic "DBGCOVB\0", then little-endian uint32 version,
+ *                 string count and region count
+ *   string table: per string, ULEB128 length then the bytes (no terminator);
+ *                 paths and details share the table and are deduplicated
+ *   regions:      per region, in output order,
+ *                   uint8    kind (`RegionKind`)
+ *                   ULEB128  path string index
+ *                   ULEB128  detail string index
+ *                   SLEB128  begin line, relative to the previous region's
+ *                   ULEB128  begin column
+ *                   ULEB128  end line, relative to this region's begin line
+ *                   ULEB128  end column
+ *
+ * `dbgcov-dump` turns this back into exactly the text output.
+ */
+
+namespace dbgcov {
+
+const char BinaryMagic[8] = {'D', 'B', 'G', 'C', 'O', 'V', 'B', '\0'};
+const uint32_t BinaryVersion = 1;
+
+bool IsBinaryRegionData(llvm::StringRef data);
+
+// Buffers a translation unit's regions and writes the section on `Finish`
+class BinaryRegionSink : public RegionSink {
+public:
+  explicit BinaryRegionSink(llvm::raw_ostream &OS) : OS(OS) {}
+  void AddRegion(const Region &region) override;
+  void Finish() override;
+
+private:
+  uint32_t GetStringIndex(llvm::StringRef str);
+
+  llvm::raw_ostream &OS;
+  llvm::StringMap<uint32_t> StringIndices;
+  std::vector<llvm::StringRef> Strings;
+  llvm::SmallVector<char, 0> Records;
+  uint32_t NumRegions = 0;
+  unsigned LastBeginLine = 0;
+};
+
+// Decode every section in `data`, in order. Strings passed to `callback` point
+// into `data`.
+llvm::Error
+ReadBinaryRegions(llvm::StringRef data,
+                  llvm::function_ref<void(const Region &)> callback);
+
+} // namespace dbgcov
+
+#endif
@@ -0,0 +1,107 @@
+#include "canonical-regions.h"
+
+#include <algorithm>
+#include <climits>
+#include <tuple>
+
+using namespace llvm;
+
+namespace dbgcov {
+
+// Where a region ends, with column 0 (whole lines) ordered after any column
+static std::pair<unsigned, unsigned> GetEnd(const Region &region) {
+  return std::make_pair(region.EndLine,
+                        region.EndColumn ? region.EndColumn : UINT_MAX);
+}
+
+static bool CanMerge(const Region &first, const Region &second) {
+  // Sorted, so `second` doesn't begin before `first`
+  if (std::make_pair(second.BeginLine, second.BeginColumn) <= GetEnd(first))
+    return true;
+  return second.BeginLine == first.EndLine + 1 && second.BeginColumn <= 1;
+}
+
+void CanonicalRegionSink::BeginFunction(StringRef name, StringRef path,
+                                        unsigned line) {
+  Flush();
+  Next->BeginFunction(name, path, line);
+}
+
+void CanonicalRegionSink::Finish() {
+  Flush();
+  Next->Finish();
+}
+
+void CanonicalRegionSink::Flush() {
+  if (Buffered.empty())
+    return;
+
+  // Every line with computation, then runs of them
+  Lines.clear();
+  for (const auto &region : Buffered)
+    if (region.Kind == RegionKind::Computation)
+      for (unsigned line = region.BeginLine; line <= region.EndLine; ++line)
+        Lines.emplace_back(region.Path, line);
+  std::sort(Lines.begin(), Lines.end());
+  Lines.erase(std::unique(Lines.begin(), Lines.end()), Lines.end());
+  Output.clear();
+  for (size_t begin = 0, end; begin < Lines.size(); begin = end) {
+    for (end = begin + 1; end < Lines.size() &&
+                          Lines[end].first == Lines[begin].first &&
+                          Lines[end].second == Lines[end - 1].second + 1;
+         ++end)
+      ;
+    Region region;
+    region.Path = Lines[begin].first;
+    region.BeginLine = Lines[begin].second;
+    region.BeginColumn = 0;
+    region.EndLine = Lines[end - 1].second;
+    region.EndColumn = 0;
+    region.Kind = RegionKind::Computation;
+    region.Detail = "Lines";
+    Output.push_back(region);
+  }
+
+  // Each variable's regions of each kind, in order of where they begin,
+  // merged into the last one kept wherever possible
+  Buffered.erase(std::remove_if(Buffered.begin(), Buffered.end(),
+                                [](const Region &region) {
+                                  return region.Kind ==
+                                         RegionKind::Computation;
+                                }),
+                 Buffered.end());
+  std::sort(Buffered.begin(), Buffered.end(),
+            [](const Region &a, const Region &b) {
+              return std::tie(a.Kind, a.Detail, a.Path, a.BeginLine,
+                              a.BeginColumn) < std::tie(b.Kind, b.Detail,
+                                                        b.Path, b.BeginLine,
+                                                        b.BeginColumn);
+            });
+  size_t firstOfFunction = Output.size();
+  for (const auto &region : Buffered) {
+    if (Output.size() > firstOfFunction) {
+      Region &last = Output.back();
+      if (last.Kind == region.Kind && last.Detail == region.Detail &&
+          last.Path == region.Path && CanMerge(last, region)) {
+        if (GetEnd(region) > GetEnd(last)) {
+          last.EndLine = region.EndLine;
+          last.EndColumn = region.EndColumn;
+        }
+        continue;
+      }
+    }
+    Output.push_back(region);
+  }
+  Buffered.clear();
+
+  std::sort(Output.begin(), Output.end(), [](const Region &a, const Region &b) {
+    return std::tie(a.Path, a.BeginLine, a.BeginColumn, a.EndLine,
+                    a.EndColumn, a.Kind, a.Detail) <
+           std::tie(b.Path, b.BeginLine, b.BeginColumn, b.EndLine,
+                    b.EndColumn, b.Kind, b.Detail);
+  });
+  for (const auto &region : Output)
+    Next->AddRegion(region);
+}
+
+} // namespace dbgcov
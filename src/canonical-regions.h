@@ -0,0 +1,49 @@
+#ifndef DBGCOV_CANONICAL_REGIONS_H
+#define DBGCOV_CANONICAL_REGIONS_H
+
+#include <memory>
+#include <vector>
+
+#include "regions.h"
+
+namespace dbgcov {
+
+/* `-canonical`: the same information in fewer, sorted regions. Each
+ * function's regions are held back until the next function begins, then
+ *
+ *  - `Computation` regions are replaced by one region for each run of
+ *    consecutive lines with computation, as whole lines (both columns 0) with
+ *    detail `Lines`;
+ *  - the other regions of each variable and kind are merged wherever they
+ *    overlap, or one starts at the beginning of the line after another ends
+ *    (an end column of 0, as in whole-line regions, means the end of the
+ *    line);
+ *
+ * and the results are passed on sorted by path, begin, end, kind and detail.
+ * Duplicates (e.g. `MayBeDefined` for each use of a variable in one
+ * expression) disappear along the way.
+ */
+class CanonicalRegionSink : public RegionSink {
+public:
+  explicit CanonicalRegionSink(std::unique_ptr<RegionSink> Next)
+      : Next(std::move(Next)) {}
+  void BeginFunction(llvm::StringRef name, llvm::StringRef path,
+                     unsigned line) override;
+  void AddRegion(const Region &region) override {
+    Buffered.push_back(region);
+  }
+  void Finish() override;
+
+private:
+  void Flush();
+
+  std::unique_ptr<RegionSink> Next;
+  std::vector<Region> Buffered;
+  // Scratch space, kept to reuse its storage
+  std::vector<std::pair<llvm::StringRef, unsigned>> Lines;
+  std::vector<Region> Output;
+};
+
+} // namespace dbgcov
+
+#endif
@@ -0,0 +1,446 @@
+#include "cfg-definedness.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "clang/Analysis/CFG.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+
+using namespace clang;
+using namespace llvm;
+
+namespace dbgcov {
+
+namespace {
+
+class DefinednessAnalysis {
+public:
+  DefinednessAnalysis(const FunctionDecl &function, ASTContext &context)
+      : Function(function), Context(context),
+        Mgr(context.getSourceManager()) {}
+
+  bool Run(function_ref<void(const DefinedLines &)> callback);
+
+private:
+  struct Variable {
+    const VarDecl *Decl;
+    // Lines of the statement enclosing the declaration, as for `DeclScope`
+    unsigned ScopeBegin;
+    unsigned ScopeEnd;
+  };
+
+  bool GetLines(const Stmt &s, unsigned &begin, unsigned &end) const;
+  void AddVariable(const VarDecl &decl, const Stmt &scope);
+  void FindVariables();
+  int GetVariableIndex(const Expr *e, bool &whole) const;
+  void Define(const Expr *e, BitVector &must, BitVector &may) const;
+  void Transfer(const Stmt *s, BitVector &must, BitVector &may) const;
+  void ComputeIn(const CFGBlock &block, BitVector &must, BitVector &may) const;
+  void RecordLines(unsigned begin, unsigned end, const BitVector &must,
+                   const BitVector &may);
+  void FindRuns(const std::vector<BitVector> &lines, RegionKind kind,
+                std::vector<std::pair<unsigned, DefinedLines>> &runs) const;
+
+  const FunctionDecl &Function;
+  ASTContext &Context;
+  const SourceManager &Mgr;
+  // Presumed filename (interned, so compared by pointer) and lines of the body
+  const char *FileName = nullptr;
+  unsigned FirstLine = 0;
+  unsigned LastLine = 0;
+
+  std::vector<Variable> Variables;
+  DenseMap<const VarDecl *, unsigned> VariableIndices;
+  // Defined on entry: parameters and static locals
+  BitVector EntryDefined;
+
+  std::unique_ptr<CFG> Graph;
+  std::vector<const CFGBlock *> ReversePostOrder;
+  BitVector Reachable;
+  std::vector<BitVector> MustOut;
+  std::vector<BitVector> MayOut;
+
+  // Per line of the body: variables defined before all (must) or any (may)
+  // of the code on it; empty if the line has no code
+  std::vector<BitVector> LineMust;
+  std::vector<BitVector> LineMay;
+};
+
+} // namespace
+
+bool DefinednessAnalysis::GetLines(const Stmt &s, unsigned &begin,
+                                   unsigned &end) const {
+  PresumedLoc beginLoc = Mgr.getPresumedLoc(Mgr.getExpansionLoc(s.getBeginLoc()));
+  PresumedLoc endLoc = Mgr.getPresumedLoc(Mgr.getExpansionLoc(s.getEndLoc()));
+  if (beginLoc.isInvalid() || endLoc.isInvalid() ||
+      beginLoc.getFilename() != FileName || endLoc.getFilename() != FileName)
+    return false;
+  begin = beginLoc.getLine();
+  end = endLoc.getLine();
+  return begin <= end;
+}
+
+void DefinednessAnalysis::AddVariable(const VarDecl &decl, const Stmt &scope) {
+  Variable variable;
+  variable.Decl = &decl;
+  // An empty scope if we can't place it, so it's never reported
+  if (!GetLines(scope, variable.ScopeBegin, variable.ScopeEnd)) {
+    variable.ScopeBegin = 1;
+    variable.ScopeEnd = 0;
+  }
+  VariableIndices[&decl] = Variables.size();
+  Variables.push_back(variable);
+}
+
+void DefinednessAnalysis::FindVariables() {
+  const Stmt *body = Function.getBody();
+  for (const auto *param : Function.parameters())
+    AddVariable(*param, *body);
+
+  // Locals, each with the innermost non-`Expr` statement around its
+  // `DeclStmt`, as the lexical analysis uses for its scope
+  SmallVector<std::pair<const Stmt *, const Stmt *>, 32> workQueue;
+  workQueue.emplace_back(body, nullptr);
+  while (!workQueue.empty()) {
+    const Stmt *s = workQueue.back().first;
+    const Stmt *parent = workQueue.back().second;
+    workQueue.pop_back();
+    if (const auto *declStmt = dyn_cast<DeclStmt>(s)) {
+      for (const auto *decl : declStmt->decls()) {
+        const auto *varDecl = dyn_cast<VarDecl>(decl);
+        if (varDecl && parent && isa<FunctionDecl>(varDecl->getDeclContext()) &&
+            varDecl->isLocalVarDecl())
+          AddVariable(*varDecl, *parent);
+      }
+    }
+    const Stmt *childParent = isa<Expr>(s) ? parent : s;
+    for (const auto *child : s->children())
+      if (child)
+        workQueue.emplace_back(child, childParent);
+  }
+
+  EntryDefined.resize(Variables.size());
+  for (unsigned i = 0; i < Variables.size(); ++i) {
+    const VarDecl *decl = Variables[i].Decl;
+    if (isa<ParmVarDecl>(decl) || decl->isStaticLocal())
+      EntryDefined.set(i);
+  }
+}
+
+// The variable stored to by assigning to `e`, or -1. `whole` is false if only
+// part of it is (a member or an element).
+int DefinednessAnalysis::GetVariableIndex(const Expr *e, bool &whole) const {
+  whole = true;
+  while (true) {
+    e = e->IgnoreParenImpCasts();
+    if (const auto *member = dyn_cast<MemberExpr>(e)) {
+      if (member->isArrow())
+        return -1;
+      e = member->getBase();
+    } else if (const auto *subscript = dyn_cast<ArraySubscriptExpr>(e)) {
+      // Only arrays, not pointers, are stored in the variable itself
+      const Expr *base = subscript->getBase()->IgnoreParenImpCasts();
+      if (!base->getType()->isArrayType())
+        return -1;
+      e = base;
+    } else {
+      break;
+    }
+    whole = false;
+  }
+  const auto *declRefExpr = dyn_cast<DeclRefExpr>(e);
+  if (!declRefExpr)
+    return -1;
+  const auto *varDecl = dyn_cast<VarDecl>(declRefExpr->getDecl());
+  auto found = VariableIndices.find(varDecl);
+  return found == VariableIndices.end() ? -1 : int(found->second);
+}
+
+void DefinednessAnalysis::Define(const Expr *e, BitVector &must,
+                                 BitVector &may) const {
+  bool whole;
+  int index = GetVariableIndex(e, whole);
+  if (index < 0)
+    return;
+  if (whole)
+    must.set(index);
+  may.set(index);
+}
+
+// Apply one CFG element. With `setAllAlwaysAdd`, every subexpression is an
+// element of its own, in evaluation order, so we only look at `s` itself.
+void DefinednessAnalysis::Transfer(const Stmt *s, BitVector &must,
+                                   BitVector &may) const {
+  if (const auto *op = dyn_cast<BinaryOperator>(s)) {
+    if (op->isAssignmentOp())
+      Define(op->getLHS(), must, may);
+  } else if (const auto *op = dyn_cast<UnaryOperator>(s)) {
+    if (op->isIncrementDecrementOp()) {
+      Define(op->getSubExpr(), must, may);
+    } else if (op->getOpcode() == UO_AddrOf) {
+      // Might be stored through the pointer from here on
+      bool whole;
+      int index = GetVariableIndex(op->getSubExpr(), whole);
+      if (index >= 0)
+        may.set(index);
+    }
+  } else if (const auto *declStmt = dyn_cast<DeclStmt>(s)) {
+    for (const auto *decl : declStmt->decls()) {
+      const auto *varDecl = dyn_cast<VarDecl>(decl);
+      if (!varDecl || !varDecl->hasInit())
+        continue;
+      auto found = VariableIndices.find(varDecl);
+      if (found == VariableIndices.end())
+        continue;
+      must.set(found->second);
+      may.set(found->second);
+    }
+  } else if (const auto *asmStmt = dyn_cast<AsmStmt>(s)) {
+    for (const auto *output : asmStmt->outputs())
+      Define(output, must, may);
+  }
+}
+
+// Meet over the block's reachable predecessors
+void DefinednessAnalysis::ComputeIn(const CFGBlock &block, BitVector &must,
+                                    BitVector &may) const {
+  if (&block == &Graph->getEntry()) {
+    must = EntryDefined;
+    may = EntryDefined;
+    return;
+  }
+  must.set();
+  may.reset();
+  for (const CFGBlock *pred : block.preds()) {
+    if (!pred || !Reachable.test(pred->getBlockID()))
+      continue;
+    must &= MustOut[pred->getBlockID()];
+    may |= MayOut[pred->getBlockID()];
+  }
+}
+
+void DefinednessAnalysis::RecordLines(unsigned begin, unsigned end,
+                                      const BitVector &must,
+                                      const BitVector &may) {
+  begin = std::max(begin, FirstLine);
+  end = std::min(end, LastLine);
+  for (unsigned line = begin; line <= end; ++line) {
+    BitVector &lineMust = LineMust[line - FirstLine];
+    BitVector &lineMay = LineMay[line - FirstLine];
+    if (lineMust.empty()) {
+      lineMust = must;
+      lineMay = may;
+    } else {
+      lineMust &= must;
+      lineMay |= may;
+    }
+  }
+}
+
+/* Find the runs of lines on which each variable is in scope and set in
+ * `lines`, appending them to `runs` keyed by variable and kind. This is one
+ * pass over the lines: each line with code is compared with the one before,
+ * a word at a time, and only the variables whose state differs open or close
+ * a run. So the cost is in the number of lines times the number of words per
+ * line, plus the number of runs, rather than lines times variables. */
+void DefinednessAnalysis::FindRuns(
+    const std::vector<BitVector> &lines, RegionKind kind,
+    std::vector<std::pair<unsigned, DefinedLines>> &runs) const {
+  unsigned numVariables = Variables.size();
+  auto scopeBegin = [&](unsigned i) {
+    return std::max(Variables[i].ScopeBegin, FirstLine);
+  };
+  auto scopeEnd = [&](unsigned i) {
+    return std::min(Variables[i].ScopeEnd, LastLine);
+  };
+  // Variables in order of the first and of the last lines of their scopes
+  std::vector<unsigned> byBegin, byEnd;
+  for (unsigned i = 0; i < numVariables; ++i) {
+    if (scopeBegin(i) <= scopeEnd(i)) {
+      byBegin.push_back(i);
+      byEnd.push_back(i);
+    }
+  }
+  std::sort(byBegin.begin(), byBegin.end(), [&](unsigned a, unsigned b) {
+    return scopeBegin(a) < scopeBegin(b);
+  });
+  std::sort(byEnd.begin(), byEnd.end(), [&](unsigned a, unsigned b) {
+    return scopeEnd(a) < scopeEnd(b);
+  });
+
+  DefinedLines run;
+  run.Kind = kind;
+  unsigned key = kind == RegionKind::MayBeDefined;
+  std::vector<unsigned> runBegins(numVariables);
+  auto closeRun = [&](unsigned i, unsigned end) {
+    run.Var = Variables[i].Decl;
+    run.BeginLine = runBegins[i];
+    run.EndLine = end;
+    runs.emplace_back(2 * i + key, run);
+  };
+
+  BitVector inScope(numVariables), previous(numVariables), current, changed;
+  auto nextBegin = byBegin.begin(), nextEnd = byEnd.begin();
+  unsigned previousLine = 0;
+  for (unsigned line = FirstLine; line <= LastLine; ++line) {
+    const BitVector &defined = lines[line - FirstLine];
+    if (defined.empty())
+      continue;
+    for (; nextBegin != byBegin.end() && scopeBegin(*nextBegin) <= line;
+         ++nextBegin)
+      inScope.set(*nextBegin);
+    for (; nextEnd != byEnd.end() && scopeEnd(*nextEnd) < line; ++nextEnd)
+      inScope.reset(*nextEnd);
+    current = defined;
+    current &= inScope;
+    changed = current;
+    changed ^= previous;
+    for (unsigned i : changed.set_bits()) {
+      if (current.test(i))
+        runBegins[i] = line;
+      else
+        closeRun(i, previousLine);
+    }
+    std::swap(previous, current);
+    previousLine = line;
+  }
+  for (unsigned i : previous.set_bits())
+    closeRun(i, previousLine);
+}
+
+bool DefinednessAnalysis::Run(
+    function_ref<void(const DefinedLines &)> callback) {
+  Stmt *body = Function.getBody();
+  PresumedLoc bodyBegin =
+      Mgr.getPresumedLoc(Mgr.getExpansionLoc(body->getBeginLoc()));
+  if (bodyBegin.isInvalid())
+    return false;
+  FileName = bodyBegin.getFilename();
+  if (!GetLines(*body, FirstLine, LastLine))
+    return false;
+
+  CFG::BuildOptions options;
+  options.setAllAlwaysAdd();
+  Graph = CFG::buildCFG(&Function, body, &Context, options);
+  if (!Graph)
+    return false;
+
+  FindVariables();
+  unsigned numVariables = Variables.size();
+  if (!numVariables)
+    return true;
+
+  // Blocks in reverse post-order from the entry, so that each pass of the
+  // solver below sees a block's forward predecessors before the block itself
+  unsigned numBlocks = Graph->getNumBlockIDs();
+  Reachable.resize(numBlocks);
+  SmallVector<std::pair<const CFGBlock *, CFGBlock::const_succ_iterator>, 32>
+      stack;
+  const CFGBlock &entry = Graph->getEntry();
+  Reachable.set(entry.getBlockID());
+  stack.emplace_back(&entry, entry.succ_begin());
+  while (!stack.empty()) {
+    const CFGBlock *block = stack.back().first;
+    auto &next = stack.back().second;
+    if (next == block->succ_end()) {
+      ReversePostOrder.push_back(block);
+      stack.pop_back();
+      continue;
+    }
+    const CFGBlock *succ = *next++;
+    if (succ && !Reachable.test(succ->getBlockID())) {
+      Reachable.set(succ->getBlockID());
+      stack.emplace_back(succ, succ->succ_begin());
+    }
+  }
+  std::reverse(ReversePostOrder.begin(), ReversePostOrder.end());
+
+  std::vector<BitVector> mustGen(numBlocks, BitVector(numVariables));
+  std::vector<BitVector> mayGen(numBlocks, BitVector(numVariables));
+  for (const CFGBlock *block : ReversePostOrder) {
+    for (const CFGElement &element : *block) {
+      auto cfgStmt = element.getAs<CFGStmt>();
+      if (cfgStmt)
+        Transfer(cfgStmt->getStmt(), mustGen[block->getBlockID()],
+                 mayGen[block->getBlockID()]);
+    }
+  }
+
+  // Round-robin until nothing changes; in reverse post-order this takes a
+  // pass or two more than the depth of loop nesting. Must-define starts
+  // everywhere from "all defined" and shrinks, may-define from "none".
+  MustOut.assign(numBlocks, BitVector(numVariables, true));
+  MayOut.assign(numBlocks, BitVector(numVariables));
+  BitVector must(numVariables), may(numVariables);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const CFGBlock *block : ReversePostOrder) {
+      unsigned id = block->getBlockID();
+      ComputeIn(*block, must, may);
+      must |= mustGen[id];
+      may |= mayGen[id];
+      if (must != MustOut[id]) {
+        MustOut[id] = must;
+        changed = true;
+      }
+      if (may != MayOut[id]) {
+        MayOut[id] = may;
+        changed = true;
+      }
+    }
+  }
+
+  // Replay each block from its fixed-point input to find the state before
+  // each element, and so on each line
+  LineMust.assign(LastLine - FirstLine + 1, BitVector());
+  LineMay.assign(LastLine - FirstLine + 1, BitVector());
+  for (const CFGBlock *block : ReversePostOrder) {
+    ComputeIn(*block, must, may);
+    for (const CFGElement &element : *block) {
+      auto cfgStmt = element.getAs<CFGStmt>();
+      if (!cfgStmt)
+        continue;
+      const Stmt *s = cfgStmt->getStmt();
+      unsigned begin, end;
+      if (GetLines(*s, begin, end))
+        RecordLines(begin, end, must, may);
+      Transfer(s, must, may);
+    }
+  }
+  // The closing brace is where the epilogue is
+  const CFGBlock &exit = Graph->getExit();
+  if (Reachable.test(exit.getBlockID())) {
+    ComputeIn(exit, must, may);
+    RecordLines(LastLine, LastLine, must, may);
+  }
+
+  // Report them by variable, must before may, and then by line
+  std::vector<std::pair<unsigned, DefinedLines>> runs;
+  FindRuns(LineMust, RegionKind::MustBeDefined, runs);
+  FindRuns(LineMay, RegionKind::MayBeDefined, runs);
+  std::stable_sort(runs.begin(), runs.end(),
+                   [](const std::pair<unsigned, DefinedLines> &a,
+                      const std::pair<unsigned, DefinedLines> &b) {
+                     return a.first < b.first;
+                   });
+  for (const auto &run : runs)
+    callback(run.second);
+  return true;
+}
+
+bool AnalyseDefinedness(const FunctionDecl &function, ASTContext &context,
+                        function_ref<void(const DefinedLines &)> callback) {
+  if (!function.getBody())
+    return false;
+  DefinednessAnalysis analysis(function, context);
+  return analysis.Run(callback);
+}
+
+} // namespace dbgcov
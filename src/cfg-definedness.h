@@ -0,0 +1,38 @@
+#ifndef DBGCOV_CFG_DEFINEDNESS_H
+#define DBGCOV_CFG_DEFINEDNESS_H
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "llvm/ADT/STLExtras.h"
+
+#include "regions.h"
+
+namespace dbgcov {
+
+// A run of lines on which a variable is defined. Lines without any code of
+// their own (blank lines, comments, lone braces) don't break a run.
+struct DefinedLines {
+  const clang::VarDecl *Var;
+  // `MustBeDefined` or `MayBeDefined`
+  RegionKind Kind;
+  unsigned BeginLine;
+  unsigned EndLine;
+};
+
+/* For `-definedness=cfg`: find where the parameters and local variables of
+ * `function` are defined by solving must-define (on all paths) and may-define
+ * (on some path) forward dataflow problems over its `clang::CFG`, with one bit
+ * per variable. A variable is taken as defined on a line if it is defined
+ * before every (must) or some (may) piece of code on that line, and is only
+ * reported within the lines of its scope.
+ *
+ * Lines are presumed lines of the file the body starts in. Returns false,
+ * reporting nothing, if no CFG can be built for the body.
+ */
+bool AnalyseDefinedness(const clang::FunctionDecl &function,
+                        clang::ASTContext &context,
+                        llvm::function_ref<void(const DefinedLines &)> callback);
+
+} // namespace dbgcov
+
+#endif
@@ -0,0 +1,276 @@
+#include "columnar-reader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "llvm/ADT/DenseMap.h"
+
+#include "compressed-output.h"
+
+using namespace llvm;
+
+namespace dbgcov {
+
+// Smaller inputs aren't worth another thread
+static const size_t MinChunkSize = 1 << 20;
+
+namespace {
+
+// Strings numbered in order of first appearance
+class StringTable {
+public:
+  uint32_t Intern(StringRef string) {
+    // Consecutive regions usually share a path, and often a variable
+    if (!Strings.empty() && string == Strings[Last])
+      return Last;
+    auto inserted = Indices.insert(std::make_pair(string, Strings.size()));
+    if (inserted.second)
+      Strings.push_back(string);
+    Last = inserted.first->second;
+    return Last;
+  }
+
+  std::vector<StringRef> Strings;
+
+private:
+  DenseMap<StringRef, uint32_t> Indices;
+  uint32_t Last = 0;
+};
+
+// One thread's share of the input, parsed with its own string tables
+struct Chunk {
+  const char *Begin;
+  const char *End;
+
+  StringTable Paths;
+  StringTable Details;
+  std::vector<uint32_t> Path;
+  std::vector<uint32_t> BeginLine;
+  std::vector<uint32_t> BeginColumn;
+  std::vector<uint32_t> EndLine;
+  std::vector<uint32_t> EndColumn;
+  std::vector<RegionKind> Kind;
+  std::vector<uint32_t> Detail;
+
+  // Lines parsed, and the first bad one (counting from 1), if any
+  unsigned Lines = 0;
+  unsigned ErrorLine = 0;
+};
+
+} // namespace
+
+// Parse the digits ending just before `end`, stopping at `begin`, and return
+// where they start (or null if there are none, or too many)
+static const char *ParseNumberBackwards(const char *begin, const char *end,
+                                        uint32_t &value) {
+  const char *digits = end;
+  while (digits > begin && unsigned(digits[-1] - '0') < 10)
+    --digits;
+  if (digits == end || end - digits > 10)
+    return nullptr;
+  uint64_t result = 0;
+  for (const char *p = digits; p < end; ++p)
+    result = result * 10 + (*p - '0');
+  if (result > UINT32_MAX)
+    return nullptr;
+  value = result;
+  return digits;
+}
+
+// `<path>:<line>:<col>`, as `ParseLocation` in regions.cpp
+static bool ParseLocation(const char *begin, const char *end, StringRef &path,
+                          uint32_t &line, uint32_t &column) {
+  const char *p = ParseNumberBackwards(begin, end, column);
+  if (!p || p == begin || *--p != ':')
+    return false;
+  p = ParseNumberBackwards(begin, p, line);
+  if (!p || p == begin || *--p != ':' || p == begin)
+    return false;
+  path = StringRef(begin, p - begin);
+  return true;
+}
+
+static bool ParseLine(Chunk &chunk, const char *line, const char *end) {
+  size_t size = end - line;
+  const char *tab1 = static_cast<const char *>(std::memchr(line, '\t', size));
+  if (!tab1)
+    return false;
+  const char *tab2 =
+      static_cast<const char *>(std::memchr(tab1 + 1, '\t', end - tab1 - 1));
+  if (!tab2)
+    return false;
+  // The detail is the rest of the line, tabs and all
+  const char *tab3 =
+      static_cast<const char *>(std::memchr(tab2 + 1, '\t', end - tab2 - 1));
+  StringRef kindText = tab3 ? StringRef(tab2 + 1, tab3 - tab2 - 1)
+                            : StringRef(tab2 + 1, end - tab2 - 1);
+  StringRef detail = tab3 ? StringRef(tab3 + 1, end - tab3 - 1) : StringRef();
+
+  StringRef path, endPath;
+  uint32_t beginLine, beginColumn, endLine, endColumn;
+  RegionKind kind;
+  if (!ParseLocation(line, tab1, path, beginLine, beginColumn) ||
+      !ParseLocation(tab1 + 1, tab2, endPath, endLine, endColumn) ||
+      endPath != path || !ParseRegionKind(kindText, kind))
+    return false;
+
+  chunk.Path.push_back(chunk.Paths.Intern(path));
+  chunk.BeginLine.push_back(beginLine);
+  chunk.BeginColumn.push_back(beginColumn);
+  chunk.EndLine.push_back(endLine);
+  chunk.EndColumn.push_back(endColumn);
+  chunk.Kind.push_back(kind);
+  chunk.Detail.push_back(chunk.Details.Intern(detail));
+  return true;
+}
+
+static void ParseChunk(Chunk &chunk) {
+  // A guess from the usual line length, to save most regrowing
+  size_t expected = (chunk.End - chunk.Begin) / 64;
+  chunk.Path.reserve(expected);
+  chunk.BeginLine.reserve(expected);
+  chunk.BeginColumn.reserve(expected);
+  chunk.EndLine.reserve(expected);
+  chunk.EndColumn.reserve(expected);
+  chunk.Kind.reserve(expected);
+  chunk.Detail.reserve(expected);
+
+  for (const char *line = chunk.Begin; line < chunk.End;) {
+    const char *end = static_cast<const char *>(
+        std::memchr(line, '\n', chunk.End - line));
+    if (!end)
+      end = chunk.End;
+    ++chunk.Lines;
+    if (end != line && !ParseLine(chunk, line, end)) {
+      chunk.ErrorLine = chunk.Lines;
+      return;
+    }
+    line = end + 1;
+  }
+}
+
+// Run `work(i)` for each `i` below `count`, each on its own thread
+template <typename Work> static void RunInParallel(size_t count, Work work) {
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < count; ++i)
+    threads.emplace_back(work, i);
+  if (count)
+    work(0);
+  for (auto &thread : threads)
+    thread.join();
+}
+
+// Renumber `local` through `map` onto the end of `out`
+static void Renumber(const std::vector<uint32_t> &local,
+                     const std::vector<uint32_t> &map, uint32_t *out) {
+  for (uint32_t index : local)
+    *out++ = map[index];
+}
+
+template <typename T>
+static void Copy(const std::vector<T> &from, std::vector<T> &to,
+                 size_t offset) {
+  std::copy(from.begin(), from.end(), to.begin() + offset);
+}
+
+Error ReadTextRegionColumns(StringRef data, RegionColumns &columns,
+                            unsigned jobs) {
+  if (!jobs)
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  size_t numChunks =
+      std::max<size_t>(1, std::min<size_t>(jobs, data.size() / MinChunkSize));
+
+  // Split evenly, then move each boundary on to the start of a line
+  std::vector<Chunk> chunks(numChunks);
+  const char *begin = data.begin();
+  for (size_t i = 0; i < numChunks; ++i) {
+    chunks[i].Begin = begin;
+    const char *end = data.begin() + data.size() * (i + 1) / numChunks;
+    if (end < begin)
+      end = begin;
+    if (i + 1 < numChunks && end < data.end()) {
+      const void *newline = std::memchr(end, '\n', data.end() - end);
+      end = newline ? static_cast<const char *>(newline) + 1 : data.end();
+    } else {
+      end = data.end();
+    }
+    chunks[i].End = end;
+    begin = end;
+  }
+
+  RunInParallel(numChunks, [&](size_t i) { ParseChunk(chunks[i]); });
+
+  unsigned lines = 0;
+  for (const auto &chunk : chunks) {
+    if (chunk.ErrorLine)
+      return createStringError(inconvertibleErrorCode(),
+                               "malformed region on line %u",
+                               lines + chunk.ErrorLine);
+    lines += chunk.Lines;
+  }
+
+  // Merge the string tables in order, so strings are numbered by their first
+  // appearance in the whole input
+  StringTable paths, details;
+  std::vector<std::vector<uint32_t>> pathMaps(numChunks),
+      detailMaps(numChunks);
+  std::vector<size_t> offsets(numChunks + 1, 0);
+  for (size_t i = 0; i < numChunks; ++i) {
+    for (StringRef path : chunks[i].Paths.Strings)
+      pathMaps[i].push_back(paths.Intern(path));
+    for (StringRef detail : chunks[i].Details.Strings)
+      detailMaps[i].push_back(details.Intern(detail));
+    offsets[i + 1] = offsets[i] + chunks[i].Kind.size();
+  }
+  columns.Paths = std::move(paths.Strings);
+  columns.Details = std::move(details.Strings);
+
+  size_t total = offsets[numChunks];
+  columns.Path.resize(total);
+  columns.BeginLine.resize(total);
+  columns.BeginColumn.resize(total);
+  columns.EndLine.resize(total);
+  columns.EndColumn.resize(total);
+  columns.Kind.resize(total);
+  columns.Detail.resize(total);
+  RunInParallel(numChunks, [&](size_t i) {
+    Chunk &chunk = chunks[i];
+    size_t offset = offsets[i];
+    Renumber(chunk.Path, pathMaps[i], columns.Path.data() + offset);
+    Renumber(chunk.Detail, detailMaps[i], columns.Detail.data() + offset);
+    Copy(chunk.BeginLine, columns.BeginLine, offset);
+    Copy(chunk.BeginColumn, columns.BeginColumn, offset);
+    Copy(chunk.EndLine, columns.EndLine, offset);
+    Copy(chunk.EndColumn, columns.EndColumn, offset);
+    Copy(chunk.Kind, columns.Kind, offset);
+  });
+  return Error::success();
+}
+
+Error ReadTextRegionColumnsFromFile(
+    StringRef path, RegionColumns &columns, unsigned jobs,
+    std::chrono::steady_clock::duration *readTime) {
+  auto start = std::chrono::steady_clock::now();
+  // Large files are mapped rather than read
+  auto buffer = MemoryBuffer::getFile(path, /* IsText = */ false,
+                                      /* RequiresNullTerminator = */ false);
+  if (!buffer)
+    return createStringError(buffer.getError(), "%s",
+                             buffer.getError().message().c_str());
+  columns.Buffer = std::move(*buffer);
+  StringRef data = columns.Buffer->getBuffer();
+  if (IsCompressedRegionData(data)) {
+    std::string decompressed;
+    if (Error error = DecompressRegionData(data, decompressed))
+      return error;
+    columns.Buffer = MemoryBuffer::getMemBufferCopy(decompressed, path);
+    data = columns.Buffer->getBuffer();
+  }
+  if (readTime)
+    *readTime = std::chrono::steady_clock::now() - start;
+  return ReadTextRegionColumns(data, columns, jobs);
+}
+
+} // namespace dbgcov
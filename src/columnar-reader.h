@@ -0,0 +1,63 @@
+#ifndef DBGCOV_COLUMNAR_READER_H
+#define DBGCOV_COLUMNAR_READER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "regions.h"
+
+/* A fast reader for the text output format, for archives of `.dbgcov` files
+ * too big to read a `Region` at a time. The data is split on line boundaries
+ * into a chunk for each thread; each chunk is scanned with `memchr` (so with
+ * whatever vector instructions the C library uses) and parsed into columns,
+ * with its paths and details interned locally. The chunks' string tables are
+ * then merged, in order, and their columns renumbered and concatenated.
+ *
+ * The result is the same as from `ReadTextRegions`, whatever the number of
+ * threads: regions in file order, and strings numbered by first appearance.
+ */
+
+namespace dbgcov {
+
+// Regions as parallel arrays: region `i` is made of element `i` of each
+struct RegionColumns {
+  // Interned strings, referred to by index from `Path` and `Detail`
+  std::vector<llvm::StringRef> Paths;
+  std::vector<llvm::StringRef> Details;
+
+  std::vector<uint32_t> Path;
+  std::vector<uint32_t> BeginLine;
+  std::vector<uint32_t> BeginColumn;
+  std::vector<uint32_t> EndLine;
+  std::vector<uint32_t> EndColumn;
+  std::vector<RegionKind> Kind;
+  std::vector<uint32_t> Detail;
+
+  // What the strings point into, when read from a file
+  std::unique_ptr<llvm::MemoryBuffer> Buffer;
+
+  size_t size() const { return Kind.size(); }
+};
+
+// Parse text-format regions from `data`, which must outlive `columns`, on up
+// to `jobs` threads (0: one per hardware thread)
+llvm::Error ReadTextRegionColumns(llvm::StringRef data, RegionColumns &columns,
+                                  unsigned jobs = 0);
+
+// The same for the file at `path`, which is mapped into memory (or
+// decompressed, if it was written with `-compress`). If `readTime` is given,
+// the time taken to do that (and not to parse) is stored there.
+llvm::Error ReadTextRegionColumnsFromFile(
+    llvm::StringRef path, RegionColumns &columns, unsigned jobs = 0,
+    std::chrono::steady_clock::duration *readTime = nullptr);
+
+} // namespace dbgcov
+
+#endif
@@ -0,0 +1,191 @@
+#include "compressed-output.h"
+
+#include <cstring>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/Endian.h"
+
+using namespace llvm;
+using llvm::support::endian::read32le;
+using llvm::support::endian::write32le;
+
+namespace dbgcov {
+
+static Error FormatError(const Twine &message) {
+  return createStringError(inconvertibleErrorCode(), "%s",
+                           message.str().c_str());
+}
+
+/* LLVM 15 moved `llvm::zlib` into `llvm::compression`, and LLVM 16 added
+ * `compression::zstd` (renaming `uncompress` to `decompress` as it did so).
+ * Older LLVMs can only write zlib. */
+
+bool IsCompressionAvailable(Compression compression) {
+  switch (compression) {
+  case Compression::None:
+    return true;
+  case Compression::Zlib:
+#if LLVM_VERSION_MAJOR >= 15
+    return compression::zlib::isAvailable();
+#else
+    return zlib::isAvailable();
+#endif
+  case Compression::Zstd:
+#if LLVM_VERSION_MAJOR >= 16
+    return compression::zstd::isAvailable();
+#else
+    return false;
+#endif
+  }
+  return false;
+}
+
+const char *GetCompressionName(Compression compression) {
+  switch (compression) {
+  case Compression::None:
+    return "none";
+  case Compression::Zlib:
+    return "zlib";
+  case Compression::Zstd:
+    return "zstd";
+  }
+  return "unknown";
+}
+
+static void Compress(Compression compression, StringRef input,
+                     SmallVectorImpl<char> &output) {
+#if LLVM_VERSION_MAJOR >= 15
+  SmallVector<uint8_t, 0> compressed;
+#if LLVM_VERSION_MAJOR >= 16
+  if (compression == Compression::Zstd)
+    compression::zstd::compress(arrayRefFromStringRef(input), compressed);
+  else
+#else
+  assert(compression == Compression::Zlib);
+  (void)compression;
+#endif
+    compression::zlib::compress(arrayRefFromStringRef(input), compressed);
+  output.assign(compressed.begin(), compressed.end());
+#else
+  assert(compression == Compression::Zlib);
+  (void)compression;
+  // Only fails on running out of memory
+  cantFail(zlib::compress(input, output));
+#endif
+}
+
+static Error Decompress(Compression compression, StringRef input,
+                        size_t size, SmallVectorImpl<char> &output) {
+#if LLVM_VERSION_MAJOR >= 15
+  SmallVector<uint8_t, 0> decompressed;
+#if LLVM_VERSION_MAJOR >= 16
+  Error error =
+      compression == Compression::Zstd
+          ? compression::zstd::decompress(arrayRefFromStringRef(input),
+                                          decompressed, size)
+          : compression::zlib::decompress(arrayRefFromStringRef(input),
+                                          decompressed, size);
+#else
+  assert(compression == Compression::Zlib);
+  (void)compression;
+  Error error = compression::zlib::uncompress(arrayRefFromStringRef(input),
+                                              decompressed, size);
+#endif
+  if (error)
+    return error;
+  output.assign(decompressed.begin(), decompressed.end());
+  return Error::success();
+#else
+  assert(compression == Compression::Zlib);
+  (void)compression;
+  return zlib::uncompress(input, output, size);
+#endif
+}
+
+CompressingOStream::CompressingOStream(raw_ostream &OS,
+                                       Compression compression)
+    : raw_ostream(/* unbuffered = */ true), OS(OS), Kind(compression) {
+  assert(IsCompressionAvailable(compression) &&
+         compression != Compression::None);
+  Block.reserve(CompressionBlockSize);
+  char header[sizeof CompressedMagic + 4];
+  std::memcpy(header, CompressedMagic, sizeof CompressedMagic);
+  write32le(header + sizeof CompressedMagic, static_cast<uint32_t>(Kind));
+  OS.write(header, sizeof header);
+}
+
+CompressingOStream::~CompressingOStream() { Finish(); }
+
+void CompressingOStream::Finish() {
+  if (Finished)
+    return;
+  if (!Block.empty())
+    WriteBlock();
+  Finished = true;
+}
+
+void CompressingOStream::write_impl(const char *ptr, size_t size) {
+  assert(!Finished && "write after Finish");
+  Position += size;
+  while (size > 0) {
+    size_t count = std::min(size, CompressionBlockSize - Block.size());
+    Block.append(ptr, ptr + count);
+    ptr += count;
+    size -= count;
+    if (Block.size() == CompressionBlockSize)
+      WriteBlock();
+  }
+}
+
+void CompressingOStream::WriteBlock() {
+  SmallVector<char, 0> compressed;
+  Compress(Kind, StringRef(Block.data(), Block.size()), compressed);
+  char header[8];
+  write32le(header, Block.size());
+  write32le(header + 4, compressed.size());
+  OS.write(header, sizeof header);
+  OS.write(compressed.data(), compressed.size());
+  Block.clear();
+}
+
+bool IsCompressedRegionData(StringRef data) {
+  return data.startswith(StringRef(CompressedMagic, sizeof CompressedMagic));
+}
+
+Error DecompressRegionData(StringRef data, std::string &out) {
+  assert(IsCompressedRegionData(data));
+  data = data.drop_front(sizeof CompressedMagic);
+  if (data.size() < 4)
+    return FormatError("truncated compressed header");
+  uint32_t kind = read32le(data.data());
+  data = data.drop_front(4);
+  Compression compression = static_cast<Compression>(kind);
+  if (compression != Compression::Zlib && compression != Compression::Zstd)
+    return FormatError("unknown compression " + Twine(kind));
+  if (!IsCompressionAvailable(compression))
+    return FormatError(Twine("LLVM was built without ") +
+                       GetCompressionName(compression) + " support");
+
+  SmallVector<char, 0> block;
+  while (!data.empty()) {
+    if (data.size() < 8)
+      return FormatError("truncated compressed block header");
+    uint32_t size = read32le(data.data());
+    uint32_t compressedSize = read32le(data.data() + 4);
+    data = data.drop_front(8);
+    if (size > CompressionBlockSize || compressedSize > data.size())
+      return FormatError("truncated or corrupt compressed block");
+    block.clear();
+    if (Error error = Decompress(compression, data.take_front(compressedSize),
+                                 size, block))
+      return error;
+    out.append(block.data(), block.size());
+    data = data.drop_front(compressedSize);
+  }
+  return Error::success();
+}
+
+} // namespace dbgcov
@@ -0,0 +1,64 @@
+#ifndef DBGCOV_COMPRESSED_OUTPUT_H
+#define DBGCOV_COMPRESSED_OUTPUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+
+/* Compressed `.dbgcov` files, as written with `-compress`. Either output
+ * format can be compressed. So that regions can be compressed as they are
+ * written, with a bounded buffer, the file is a series of independently
+ * compressed blocks:
+ *
+ *   header: magic "DBGCOVZ\0", uint32 compression (1 zlib, 2 zstd)
+ *   blocks: uint32 uncompressed size, uint32 compressed size, then the
+ *           compressed bytes; at most `CompressionBlockSize` uncompressed
+ *
+ * All integers are little-endian.
+ */
+
+namespace dbgcov {
+
+const char CompressedMagic[8] = {'D', 'B', 'G', 'C', 'O', 'V', 'Z', '\0'};
+
+enum class Compression : uint32_t { None = 0, Zlib = 1, Zstd = 2 };
+
+const size_t CompressionBlockSize = 1 << 20;
+
+// Whether LLVM was built with support for `compression`
+bool IsCompressionAvailable(Compression compression);
+const char *GetCompressionName(Compression compression);
+
+// Compresses everything written to it onto another stream, a block at a time
+class CompressingOStream : public llvm::raw_ostream {
+public:
+  CompressingOStream(llvm::raw_ostream &OS, Compression compression);
+  ~CompressingOStream() override;
+
+  // Write out what remains. Nothing more may be written afterwards.
+  void Finish();
+
+private:
+  void write_impl(const char *ptr, size_t size) override;
+  uint64_t current_pos() const override { return Position; }
+  void WriteBlock();
+
+  llvm::raw_ostream &OS;
+  Compression Kind;
+  llvm::SmallVector<char, 0> Block;
+  uint64_t Position = 0;
+  bool Finished = false;
+};
+
+bool IsCompressedRegionData(llvm::StringRef data);
+// Append the decompressed contents of `data` to `out`
+llvm::Error DecompressRegionData(llvm::StringRef data, std::string &out);
+
+} // namespace dbgcov
+
+#endif
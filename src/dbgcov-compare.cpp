@@ -0,0 +1,465 @@
+/* dbgcov-compare -- measure how well an object's debug info covers the
+ * variables `dbgcov-tool` says are defined.
+ *
+ *   dbgcov-compare foo.o foo.i.dbgcov ...
+ *
+ * A variable is named as in the regions, by
+ * `<function>, <variable>, decl <file>:<line>`. From the regions, it should
+ * be available on each line of its `MustBeDefined` regions that has
+ * computation (a `Computation` region) in the same file. From the object, it
+ * is available on a line if the line table maps some address of that line
+ * into a range where the variable has a (non-empty) location. A variable's
+ * coverage is the fraction of the first set of lines also in the second, and
+ * a function's is that over all its variables (inlined copies included).
+ *
+ * Each compile unit's line table and variables are read on a worker thread
+ * (`-jobs`), producing sorted (variable, file, line) tuples that are then
+ * merge-joined with those from the regions.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/BinaryFormat/Dwarf.h"
+#include "llvm/DebugInfo/DWARF/DWARFContext.h"
+#include "llvm/DebugInfo/DWARF/DWARFDie.h"
+#include "llvm/DebugInfo/DWARF/DWARFUnit.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "region-reader.h"
+#include "regions.h"
+
+using namespace llvm;
+using namespace dbgcov;
+
+static cl::opt<std::string> ObjectFile(cl::Positional, cl::Required,
+                                       cl::desc("<object>"));
+
+static cl::list<std::string> InputFiles(cl::Positional, cl::OneOrMore,
+                                        cl::desc("<.dbgcov file>..."));
+
+static cl::opt<bool> Variables("variables",
+                               cl::desc("Also report each variable's coverage, "
+                                        "after its function's"));
+
+static cl::opt<unsigned>
+    Jobs("jobs",
+         cl::desc("Number of threads reading compile units (default: one per "
+                  "hardware thread)"),
+         cl::init(0));
+
+namespace {
+
+// A variable expected, or found, to be available on a line
+struct VariableLine {
+  uint32_t Variable;
+  uint32_t Path;
+  uint32_t Line;
+
+  bool operator<(const VariableLine &other) const {
+    return std::tie(Variable, Path, Line) <
+           std::tie(other.Variable, other.Path, other.Line);
+  }
+  bool operator==(const VariableLine &other) const {
+    return Variable == other.Variable && Path == other.Path &&
+           Line == other.Line;
+  }
+};
+
+// Variables and paths known from the regions. Only read once the regions are
+// all in, so shared by the compile unit workers.
+struct Names {
+  StringMap<uint32_t> VariableIds;
+  std::vector<StringRef> Variables;
+  StringMap<uint32_t> PathIds;
+
+  static uint32_t Intern(StringMap<uint32_t> &ids, StringRef str) {
+    return ids.insert(std::make_pair(str, uint32_t(ids.size())))
+        .first->getValue();
+  }
+  static bool Find(const StringMap<uint32_t> &ids, StringRef str,
+                   uint32_t &id) {
+    auto found = ids.find(str);
+    if (found == ids.end())
+      return false;
+    id = found->getValue();
+    return true;
+  }
+};
+
+// A line table row, as the start of the addresses belonging to its line
+struct AddressLine {
+  uint64_t SectionIndex;
+  uint64_t Address;
+  uint32_t Path;
+  uint32_t Line;
+};
+
+} // namespace
+
+// Paths are compared without `.` and `..` components, as they are built
+// differently on each side
+static std::string NormalisePath(StringRef path) {
+  SmallString<128> normalised(path);
+  sys::path::remove_dots(normalised, /* remove_dot_dot = */ true);
+  return normalised.str().str();
+}
+
+static Error ReadRegionFile(StringRef path, Names &names,
+                            std::vector<std::pair<uint32_t, uint32_t>> &code,
+                            std::vector<VariableLine> &defined) {
+  auto buffer = MemoryBuffer::getFileOrSTDIN(path);
+  if (!buffer)
+    return createStringError(buffer.getError(), "%s",
+                             buffer.getError().message().c_str());
+  return ReadRegions((*buffer)->getBuffer(), [&](const Region &region) {
+    if (region.Kind != RegionKind::Computation &&
+        region.Kind != RegionKind::MustBeDefined)
+      return;
+    uint32_t pathId =
+        Names::Intern(names.PathIds, NormalisePath(region.Path));
+    if (region.Kind == RegionKind::Computation) {
+      for (unsigned line = region.BeginLine; line <= region.EndLine; ++line)
+        code.emplace_back(pathId, line);
+      return;
+    }
+    uint32_t variableId = Names::Intern(names.VariableIds, region.Detail);
+    if (variableId == names.Variables.size())
+      names.Variables.push_back(
+          names.VariableIds.find(region.Detail)->getKey());
+    // Kept as a range until all the code lines are known, in `Line`
+    defined.push_back({variableId, pathId, region.BeginLine});
+    defined.push_back({variableId, pathId, region.EndLine});
+  });
+}
+
+// Each pair of `defined` entries is the first and last line of a region;
+// replace them by the lines in between that have code
+static void RestrictToCode(std::vector<VariableLine> &defined,
+                           std::vector<std::pair<uint32_t, uint32_t>> &code) {
+  std::sort(code.begin(), code.end());
+  code.erase(std::unique(code.begin(), code.end()), code.end());
+  std::vector<VariableLine> lines;
+  for (size_t i = 0; i + 1 < defined.size(); i += 2) {
+    const VariableLine &first = defined[i];
+    uint32_t last = defined[i + 1].Line;
+    for (auto it = std::lower_bound(code.begin(), code.end(),
+                                    std::make_pair(first.Path, first.Line));
+         it != code.end() && it->first == first.Path && it->second <= last;
+         ++it)
+      lines.push_back({first.Variable, first.Path, it->second});
+  }
+  std::sort(lines.begin(), lines.end());
+  lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+  defined = std::move(lines);
+}
+
+namespace {
+
+// Finds the lines on which the variables of one compile unit are available
+class UnitReader {
+public:
+  UnitReader(const Names &names, DWARFUnit &unit,
+             const DWARFDebugLine::LineTable &table, StringRef compilationDir)
+      : TheNames(names), Unit(unit), Table(table),
+        CompilationDir(compilationDir) {}
+
+  void Read(std::vector<VariableLine> &available) {
+    for (const auto &row : Table.Rows) {
+      if (row.EndSequence || row.Line == 0)
+        continue;
+      uint32_t path;
+      if (!FindFile(row.File, path))
+        continue;
+      Rows.push_back({row.Address.SectionIndex, row.Address.Address, path,
+                      row.Line});
+    }
+    std::sort(Rows.begin(), Rows.end(),
+              [](const AddressLine &a, const AddressLine &b) {
+                return std::tie(a.SectionIndex, a.Address) <
+                       std::tie(b.SectionIndex, b.Address);
+              });
+
+    for (DWARFDie die : Unit.getUnitDIE(false).children()) {
+      if (die.getTag() != dwarf::DW_TAG_subprogram)
+        continue;
+      // Declarations and abstract (inlined-only) instances have no code
+      DWARFAddressRangesVector ranges = GetRanges(die);
+      const char *name = die.getName(DINameKind::ShortName);
+      if (ranges.empty() || !name)
+        continue;
+      ReadScope(die, name, ranges, available);
+    }
+    std::sort(available.begin(), available.end());
+    available.erase(std::unique(available.begin(), available.end()),
+                    available.end());
+  }
+
+  // DWARF variables that aren't named in the regions
+  uint64_t NumUnmatched = 0;
+
+private:
+  static DWARFAddressRangesVector GetRanges(const DWARFDie &die) {
+    auto ranges = die.getAddressRanges();
+    if (!ranges) {
+      consumeError(ranges.takeError());
+      return DWARFAddressRangesVector();
+    }
+    return std::move(*ranges);
+  }
+
+  // The interned, normalised path of a line table file
+  bool FindFile(uint64_t index, uint32_t &path) {
+    auto cached = FilePaths.find(index);
+    if (cached == FilePaths.end()) {
+      std::string name;
+      uint32_t id = UINT32_MAX;
+      if (Table.getFileNameByIndex(
+              index, CompilationDir,
+              DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath, name))
+        Names::Find(TheNames.PathIds, NormalisePath(name), id);
+      cached = FilePaths.insert(std::make_pair(index, id)).first;
+    }
+    path = cached->second;
+    return path != UINT32_MAX;
+  }
+
+  void ReadScope(const DWARFDie &scope, StringRef function,
+                 const DWARFAddressRangesVector &ranges,
+                 std::vector<VariableLine> &available) {
+    for (DWARFDie child : scope.children()) {
+      switch (child.getTag()) {
+      case dwarf::DW_TAG_formal_parameter:
+      case dwarf::DW_TAG_variable:
+        ReadVariable(child, function, ranges, available);
+        break;
+      case dwarf::DW_TAG_lexical_block: {
+        DWARFAddressRangesVector blockRanges = GetRanges(child);
+        ReadScope(child, function, blockRanges.empty() ? ranges : blockRanges,
+                  available);
+        break;
+      }
+      case dwarf::DW_TAG_inlined_subroutine: {
+        // Its variables are named after the inlined function
+        const char *name = child.getName(DINameKind::ShortName);
+        DWARFAddressRangesVector inlinedRanges = GetRanges(child);
+        if (name && !inlinedRanges.empty())
+          ReadScope(child, name, inlinedRanges, available);
+        break;
+      }
+      default:
+        break;
+      }
+    }
+  }
+
+  void ReadVariable(const DWARFDie &die, StringRef function,
+                    const DWARFAddressRangesVector &scopeRanges,
+                    std::vector<VariableLine> &available) {
+    const char *name = die.getName(DINameKind::ShortName);
+    auto declFile =
+        dwarf::toUnsigned(die.findRecursively(dwarf::DW_AT_decl_file));
+    if (!name || !declFile)
+      return;
+    std::string declPath;
+    if (!Table.getFileNameByIndex(
+            *declFile, CompilationDir,
+            DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath, declPath))
+      return;
+    // As made by `GetExtendedName`
+    SmallString<128> key;
+    raw_svector_ostream stream(key);
+    stream << function << ", " << name << ", decl "
+           << sys::path::filename(declPath) << ":" << die.getDeclLine();
+    uint32_t variable;
+    if (!Names::Find(TheNames.VariableIds, key, variable)) {
+      ++NumUnmatched;
+      return;
+    }
+
+    auto locations = die.getLocations(dwarf::DW_AT_location);
+    if (!locations) {
+      consumeError(locations.takeError());
+      // A constant is available wherever the variable is in scope
+      if (die.find(dwarf::DW_AT_const_value))
+        for (const auto &range : scopeRanges)
+          AddRange(variable, range, available);
+      return;
+    }
+    for (const auto &location : *locations) {
+      // An empty expression means the variable is optimised out there
+      if (location.Expr.empty())
+        continue;
+      if (location.Range) {
+        AddRange(variable, *location.Range, available);
+        continue;
+      }
+      for (const auto &range : scopeRanges)
+        AddRange(variable, range, available);
+    }
+  }
+
+  void AddRange(uint32_t variable, const DWARFAddressRange &range,
+                std::vector<VariableLine> &available) {
+    auto it = std::lower_bound(
+        Rows.begin(), Rows.end(), range,
+        [](const AddressLine &row, const DWARFAddressRange &range) {
+          return std::tie(row.SectionIndex, row.Address) <
+                 std::tie(range.SectionIndex, range.LowPC);
+        });
+    for (; it != Rows.end() && it->SectionIndex == range.SectionIndex &&
+           it->Address < range.HighPC;
+         ++it)
+      available.push_back({variable, it->Path, it->Line});
+  }
+
+  const Names &TheNames;
+  DWARFUnit &Unit;
+  const DWARFDebugLine::LineTable &Table;
+  StringRef CompilationDir;
+  std::vector<AddressLine> Rows;
+  DenseMap<uint64_t, uint32_t> FilePaths;
+};
+
+} // namespace
+
+static void PrintCoverage(raw_ostream &OS, StringRef what, StringRef name,
+                          uint64_t covered, uint64_t defined) {
+  OS << what << "\t" << name << "\t" << covered << "\t" << defined << "\t"
+     << format("%.4f", defined ? double(covered) / defined : 0.0) << "\n";
+}
+
+int main(int argc, const char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, "dbgcov debug info comparison\n");
+
+  Names names;
+  std::vector<std::pair<uint32_t, uint32_t>> code;
+  std::vector<VariableLine> defined;
+  for (const auto &path : InputFiles) {
+    if (Error error = ReadRegionFile(path, names, code, defined)) {
+      errs() << path << ": " << toString(std::move(error)) << "\n";
+      return 1;
+    }
+  }
+  RestrictToCode(defined, code);
+
+  auto binary = object::ObjectFile::createObjectFile(ObjectFile);
+  if (!binary) {
+    errs() << ObjectFile << ": " << toString(binary.takeError()) << "\n";
+    return 1;
+  }
+  std::unique_ptr<DWARFContext> context =
+      DWARFContext::create(*binary->getBinary());
+
+  // `DWARFContext` parses lazily and without locking, so everything the
+  // workers need from it that isn't per-unit is parsed up front
+  struct UnitWork {
+    DWARFUnit *Unit;
+    const DWARFDebugLine::LineTable *Table;
+    StringRef CompilationDir;
+    std::vector<VariableLine> Available;
+    uint64_t NumUnmatched = 0;
+  };
+  std::vector<UnitWork> units;
+  for (const auto &unit : context->compile_units()) {
+    unit->getUnitDIE(/* ExtractUnitDIEOnly = */ false);
+    UnitWork work;
+    work.Unit = unit.get();
+    work.Table = context->getLineTableForUnit(unit.get());
+    const char *compilationDir = unit->getCompilationDir();
+    work.CompilationDir = compilationDir ? compilationDir : "";
+    if (work.Table)
+      units.push_back(std::move(work));
+  }
+
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i; (i = next++) < units.size();) {
+      UnitWork &work = units[i];
+      UnitReader reader(names, *work.Unit, *work.Table, work.CompilationDir);
+      reader.Read(work.Available);
+      work.NumUnmatched = reader.NumUnmatched;
+    }
+  };
+  unsigned numThreads = Jobs ? Jobs.getValue()
+                             : std::max(1u, std::thread::hardware_concurrency());
+  numThreads = std::min<size_t>(numThreads, units.size());
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < numThreads; ++i)
+    threads.emplace_back(worker);
+  for (auto &thread : threads)
+    thread.join();
+
+  std::vector<VariableLine> available;
+  uint64_t numUnmatched = 0;
+  for (auto &work : units) {
+    available.insert(available.end(), work.Available.begin(),
+                     work.Available.end());
+    numUnmatched += work.NumUnmatched;
+  }
+  // Units are already sorted; only duplicates across them (e.g. from
+  // functions defined in headers) need merging
+  std::sort(available.begin(), available.end());
+  available.erase(std::unique(available.begin(), available.end()),
+                  available.end());
+
+  // Both sides are sorted, so one pass finds the lines they share
+  std::vector<uint64_t> numDefined(names.Variables.size());
+  std::vector<uint64_t> numCovered(names.Variables.size());
+  auto it = available.begin();
+  for (const auto &line : defined) {
+    while (it != available.end() && *it < line)
+      ++it;
+    ++numDefined[line.Variable];
+    if (it != available.end() && *it == line)
+      ++numCovered[line.Variable];
+  }
+
+  // Report by function (the part of the name before the first `, `), in
+  // order of name
+  std::vector<uint32_t> order;
+  for (uint32_t variable = 0; variable < names.Variables.size(); ++variable)
+    if (numDefined[variable])
+      order.push_back(variable);
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return names.Variables[a] < names.Variables[b];
+  });
+  uint64_t totalCovered = 0, totalDefined = 0;
+  for (size_t begin = 0, end; begin < order.size(); begin = end) {
+    StringRef function = names.Variables[order[begin]].split(", ").first;
+    uint64_t covered = 0, functionDefined = 0;
+    for (end = begin; end < order.size() &&
+                      names.Variables[order[end]].split(", ").first == function;
+         ++end) {
+      covered += numCovered[order[end]];
+      functionDefined += numDefined[order[end]];
+    }
+    PrintCoverage(outs(), "function", function, covered, functionDefined);
+    if (Variables)
+      for (size_t i = begin; i < end; ++i)
+        PrintCoverage(outs(), "variable", names.Variables[order[i]],
+                      numCovered[order[i]], numDefined[order[i]]);
+    totalCovered += covered;
+    totalDefined += functionDefined;
+  }
+  PrintCoverage(outs(), "total", "", totalCovered, totalDefined);
+  if (numUnmatched)
+    errs() << "dbgcov-compare: " << numUnmatched
+           << " variables in the debug info have no regions\n";
+  return 0;
+}
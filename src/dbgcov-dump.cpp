@@ -0,0 +1,65 @@
+/* dbgcov-dump -- print binary `.dbgcov` files in the original text format.
+ *
+ * The text is byte-for-byte what `dbgcov-tool` would have written had it been
+ * run with `-output-format=text`. Compressed files (of either format) are
+ * decompressed first.
+ */
+
+#include <memory>
+#include <string>
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "binary-format.h"
+#include "compressed-output.h"
+#include "regions.h"
+
+using namespace llvm;
+using namespace dbgcov;
+
+static cl::list<std::string> InputFiles(cl::Positional, cl::OneOrMore,
+                                        cl::desc("<binary .dbgcov file>..."));
+
+int main(int argc, const char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, "dbgcov binary output dumper\n");
+
+  TextRegionSink sink(outs());
+  int status = 0;
+  for (const auto &path : InputFiles) {
+    auto buffer = MemoryBuffer::getFileOrSTDIN(path);
+    if (!buffer) {
+      errs() << path << ": " << buffer.getError().message() << "\n";
+      status = 1;
+      continue;
+    }
+    StringRef data = (*buffer)->getBuffer();
+    std::string decompressed;
+    if (IsCompressedRegionData(data)) {
+      if (Error error = DecompressRegionData(data, decompressed)) {
+        errs() << path << ": " << toString(std::move(error)) << "\n";
+        status = 1;
+        continue;
+      }
+      data = decompressed;
+      // Already text
+      if (!IsBinaryRegionData(data)) {
+        outs() << data;
+        continue;
+      }
+    }
+    if (!IsBinaryRegionData(data)) {
+      errs() << path << ": not a binary .dbgcov file\n";
+      status = 1;
+      continue;
+    }
+    auto callback = [&](const Region &region) { sink.AddRegion(region); };
+    if (Error error = ReadBinaryRegions(data, callback)) {
+      errs() << path << ": " << toString(std::move(error)) << "\n";
+      status = 1;
+    }
+  }
+  return status;
+}
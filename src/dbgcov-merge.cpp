@@ -0,0 +1,69 @@
+/* dbgcov-merge -- combine `.dbgcov` files into one indexed file.
+ *
+ * The inputs may be in either output format. The result is sorted, has
+ * duplicates (e.g. from functions defined in headers) removed, and can be
+ * queried in place with `dbgcov-query`; see `region-index.h` for its layout.
+ */
+
+#include <memory>
+#include <string>
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "region-index.h"
+#include "region-reader.h"
+#include "regions.h"
+
+using namespace llvm;
+using namespace dbgcov;
+
+static cl::list<std::string> InputFiles(cl::Positional, cl::OneOrMore,
+                                        cl::desc("<.dbgcov file>..."));
+
+static cl::opt<std::string> OutputFile("o", cl::Required,
+                                       cl::desc("Index file to write"),
+                                       cl::value_desc("file"));
+
+int main(int argc, const char **argv) {
+  // Long input lists can be passed as `@file`
+  cl::ParseCommandLineOptions(argc, argv, "dbgcov region index builder\n");
+
+  RegionIndexBuilder builder;
+  int status = 0;
+  for (const auto &path : InputFiles) {
+    auto buffer = MemoryBuffer::getFileOrSTDIN(path);
+    if (!buffer) {
+      errs() << path << ": " << buffer.getError().message() << "\n";
+      status = 1;
+      continue;
+    }
+    auto callback = [&](const Region &region) { builder.AddRegion(region); };
+    if (Error error = ReadRegions((*buffer)->getBuffer(), callback)) {
+      errs() << path << ": " << toString(std::move(error)) << "\n";
+      status = 1;
+    }
+  }
+  if (status)
+    return status;
+
+  std::error_code error;
+  raw_fd_ostream OS(OutputFile, error, sys::fs::OF_None);
+  if (error) {
+    errs() << OutputFile << ": " << error.message() << "\n";
+    return 1;
+  }
+  if (Error writeError = builder.Write(OS)) {
+    errs() << OutputFile << ": " << toString(std::move(writeError)) << "\n";
+    return 1;
+  }
+  OS.close();
+  if (OS.has_error()) {
+    errs() << OutputFile << ": " << OS.error().message() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,103 @@
+/* dbgcov-query -- look up regions in an index written by `dbgcov-merge`.
+ *
+ * Matching regions are printed in the text output format. For example, the
+ * variables that must be defined at a given line:
+ *
+ *   dbgcov-query all.dbgcovi -at=/src/foo.c:42 -kind=MustBeDefined
+ */
+
+#include <memory>
+#include <string>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "region-index.h"
+#include "regions.h"
+
+using namespace llvm;
+using namespace dbgcov;
+
+static cl::opt<std::string> IndexFile(cl::Positional, cl::Required,
+                                      cl::desc("<index file>"));
+
+static cl::opt<std::string> At("at", cl::desc("Regions covering a line"),
+                               cl::value_desc("path:line"));
+
+static cl::opt<std::string> Range("range",
+                                  cl::desc("Regions overlapping some lines"),
+                                  cl::value_desc("path:first-last"));
+
+static cl::opt<std::string>
+    Variable("var",
+             cl::desc("Regions of a variable, by extended name (e.g. "
+                      "\"main, argc, decl main.c:3\")"),
+             cl::value_desc("name"));
+
+static cl::list<std::string>
+    Kinds("kind", cl::CommaSeparated,
+          cl::desc("Only print regions of these kinds (default: all)"),
+          cl::value_desc("kind,..."));
+
+// Split "<path>:<first>[-<last>]", where the path may itself contain colons
+static bool ParseLines(StringRef text, StringRef &path, unsigned &first,
+                       unsigned &last) {
+  StringRef lines, lastText;
+  std::tie(path, lines) = text.rsplit(':');
+  if (path.empty() || lines.empty())
+    return false;
+  StringRef firstText;
+  std::tie(firstText, lastText) = lines.split('-');
+  if (firstText.getAsInteger(10, first))
+    return false;
+  last = first;
+  return lastText.empty() || !lastText.getAsInteger(10, last);
+}
+
+int main(int argc, const char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, "dbgcov region index query\n");
+
+  if (!At.empty() + !Range.empty() + !Variable.empty() != 1) {
+    errs() << "Error: give exactly one of -at, -range and -var\n";
+    return 1;
+  }
+  bool wantKind[NumRegionKinds];
+  for (unsigned kind = 0; kind < NumRegionKinds; ++kind)
+    wantKind[kind] = Kinds.empty();
+  for (const auto &name : Kinds) {
+    RegionKind kind;
+    if (!ParseRegionKind(name, kind)) {
+      errs() << "Error: unknown region kind: " << name << "\n";
+      return 1;
+    }
+    wantKind[static_cast<unsigned>(kind)] = true;
+  }
+
+  auto index = RegionIndex::Open(IndexFile);
+  if (!index) {
+    errs() << "Error: " << toString(index.takeError()) << "\n";
+    return 1;
+  }
+
+  TextRegionSink sink(outs());
+  auto callback = [&](const Region &region) {
+    if (wantKind[static_cast<unsigned>(region.Kind)])
+      sink.AddRegion(region);
+  };
+  if (!Variable.empty()) {
+    (*index)->FindVariableRegions(Variable, callback);
+    return 0;
+  }
+  StringRef path;
+  unsigned first, last;
+  if (!ParseLines(At.empty() ? Range : At, path, first, last) ||
+      (!At.empty() && first != last) || last < first) {
+    errs() << "Error: expected " << (At.empty() ? "path:first-last" : "path:line")
+           << ", not " << (At.empty() ? Range : At) << "\n";
+    return 1;
+  }
+  (*index)->FindRegions(path, first, last, callback);
+  return 0;
+}
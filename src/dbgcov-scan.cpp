@@ -0,0 +1,78 @@
+/* dbgcov-scan -- read text `.dbgcov` files with the columnar reader, and
+ * report how many regions of each kind they have and how long that took.
+ *
+ *   dbgcov-scan [-jobs=N] foo.i.dbgcov ...
+ *
+ * For each file, prints its region count and distinct paths and details,
+ * then a count per kind, then the time to map the file and to parse it, with
+ * the parse rate. Mostly useful for checking archived output, and for
+ * measuring the reader (see `columnar-reader.h`).
+ */
+
+#include <chrono>
+#include <string>
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "columnar-reader.h"
+#include "regions.h"
+
+using namespace llvm;
+using namespace dbgcov;
+
+static cl::list<std::string> InputFiles(cl::Positional, cl::OneOrMore,
+                                        cl::desc("<text .dbgcov file>..."));
+
+static cl::opt<unsigned>
+    Jobs("jobs",
+         cl::desc("Number of threads parsing each file (default: one per "
+                  "hardware thread)"),
+         cl::init(0));
+
+using Clock = std::chrono::steady_clock;
+
+static double Seconds(Clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+int main(int argc, const char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, "dbgcov text output scanner\n");
+
+  int status = 0;
+  for (const auto &path : InputFiles) {
+    RegionColumns columns;
+    Clock::duration readTime{};
+    Clock::time_point start = Clock::now();
+    if (Error error =
+            ReadTextRegionColumnsFromFile(path, columns, Jobs, &readTime)) {
+      errs() << path << ": " << toString(std::move(error)) << "\n";
+      status = 1;
+      continue;
+    }
+    Clock::duration parseTime = Clock::now() - start - readTime;
+
+    uint64_t counts[NumRegionKinds] = {};
+    for (RegionKind kind : columns.Kind)
+      ++counts[static_cast<unsigned>(kind)];
+
+    double parseSeconds = Seconds(parseTime);
+    outs() << path << ": " << columns.size() << " regions, "
+           << columns.Paths.size() << " paths, " << columns.Details.size()
+           << " details\n";
+    for (unsigned kind = 0; kind < NumRegionKinds; ++kind)
+      outs() << "  " << left_justify(
+                            GetRegionKindName(static_cast<RegionKind>(kind)),
+                            14)
+             << counts[kind] << "\n";
+    outs() << format("  read %.3fs, parse %.3fs (%.0f MiB/s)\n",
+                     Seconds(readTime), parseSeconds,
+                     parseSeconds
+                         ? columns.Buffer->getBufferSize() / parseSeconds /
+                               (1 << 20)
+                         : 0.0);
+  }
+  return status;
+}
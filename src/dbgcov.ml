@@ -12,6 +12,305 @@
 open Compiler_args
 open Unix
 
+(* If DBGCOV_SERVER names the socket of a running `dbgcov-tool -server`,
+ * hand it the analysis and return its exit status. If there is no server,
+ * or it goes away, return None so that the caller runs the tool itself.
+ * SIGPIPE is ignored meanwhile, so that a server closing the connection under
+ * us is an EPIPE error rather than the end of the compile. *)
+let tryServer inputFile outputFile =
+    match (try Some (Sys.getenv "DBGCOV_SERVER") with Not_found -> None) with
+        None -> None
+      | Some socketPath ->
+            let sock = socket PF_UNIX SOCK_STREAM 0 in
+            let oldSigpipe = Sys.signal Sys.sigpipe Sys.Signal_ignore in
+            let result = try
+                connect sock (ADDR_UNIX socketPath);
+                let request = String.concat "\n" [getcwd (); inputFile; outputFile] ^ "\n" in
+                let oc = out_channel_of_descr sock in
+                output_string oc request;
+                flush oc;
+                let ic = in_channel_of_descr sock in
+                Some (int_of_string (input_line ic))
+            with Unix_error(_, _, _) | End_of_file | Failure _ | Sys_error _ -> None
+            in
+            (try close sock with Unix_error(_, _, _) -> ());
+            (* the tool we may run next would inherit it *)
+            Sys.set_signal Sys.sigpipe oldSigpipe;
+            result
+
+(* Run the analysis of inputFile into outputFile, by the server if there is
+ * one and useServer, and return its exit status and whether we ran the tool
+ * ourselves (so with toolPath and toolFlags) rather than the server (with its
+ * own binary and options). In DBGCOV_PCH_DIR mode, source is
+ * Some (original source file, preprocessing options), which the tool parses
+ * instead; the server can't, as it applies its own options to everything. *)
+let runTool toolPath toolFlags useServer source inputFile outputFile =
+    (* Never write through an existing output file: it may be a hard link
+     * into the result cache. *)
+    (try unlink outputFile with Unix_error(_, _, _) -> ());
+    let serverStatus = match source with
+        None when useServer -> tryServer inputFile outputFile
+      | _ -> None
+    in
+    match serverStatus with
+        Some status -> (status, false)
+      | None ->
+        (* The tool writes the output itself, buffered (and compressed if
+         * DBGCOV_TOOL_FLAGS asks for it) *)
+        let outputArgs = ["-o=" ^ outputFile] in
+        let toolArgs = match source with
+            None -> [inputFile] @ outputArgs @ toolFlags @ ["--"]
+          | Some (sourceFile, cppFlags) -> [sourceFile] @ outputArgs @ toolFlags @ ["--"] @ cppFlags
+        in
+        output_string Pervasives.stderr ("output should go to " ^ outputFile ^ "\n");
+        Pervasives.flush Pervasives.stderr;
+        match fork () with
+            0 -> (try execv toolPath (Array.of_list (toolPath :: toolArgs))
+                  with Unix_error(_, _, _) -> exit 127)
+          | pid -> (match snd (waitpid [] pid) with
+                        WEXITED status -> (status, true)
+                      | WSIGNALED _ | WSTOPPED _ -> (1, true))
+
+(* A content-addressed cache of results, enabled by setting DBGCOV_CACHE_DIR.
+ * Entries are named by a digest of the preprocessed input, the tool binary's
+ * identity, the tool options and the working directory (relative paths in
+ * line markers are made absolute in the output), so a hit means the tool
+ * would produce exactly the cached output. Least recently used entries are evicted to keep
+ * the cache within DBGCOV_CACHE_MAX_SIZE (bytes, with optional K/M/G suffix;
+ * default 1G). Each lookup appends "hit" or "miss" to the cache's stats file;
+ * bin/dbgcov-cache-stats summarises it. *)
+let cacheKey toolPath toolFlags inputFile =
+    let toolStat = stat toolPath in
+    let toolId = Printf.sprintf "%d:%d:%.0f" toolStat.st_ino toolStat.st_size toolStat.st_mtime in
+    Digest.to_hex (Digest.string (String.concat "\000"
+        ([Digest.file inputFile; toolId; getcwd ()] @ toolFlags)))
+
+let parseSize s =
+    let n = String.length s in
+    let mult = if n = 0 then 1 else match s.[n - 1] with
+        'k' | 'K' -> 1024
+      | 'm' | 'M' -> 1024 * 1024
+      | 'g' | 'G' -> 1024 * 1024 * 1024
+      | _ -> 1
+    in
+    let digits = if mult = 1 then s else String.sub s 0 (n - 1) in
+    int_of_string digits * mult
+
+let cacheMaxSize () =
+    try parseSize (Sys.getenv "DBGCOV_CACHE_MAX_SIZE")
+    with Not_found | Failure _ -> 1024 * 1024 * 1024
+
+let recordCacheStat cacheDir what =
+    try
+        let fd = openfile (Filename.concat cacheDir "stats") [O_WRONLY; O_APPEND; O_CREAT] 0o644 in
+        (* one short O_APPEND write per lookup, so concurrent builds don't tear lines *)
+        ignore (write_substring fd (what ^ "\n") 0 (String.length what + 1));
+        close fd
+    with Unix_error(_, _, _) -> ()
+
+let copyFile src dst =
+    let ic = open_in_bin src in
+    let oc = open_out_bin dst in
+    let buf = Bytes.create 65536 in
+    let rec loop () =
+        let n = input ic buf 0 (Bytes.length buf) in
+        if n > 0 then (output oc buf 0 n; loop ())
+    in
+    loop ();
+    close_in ic;
+    close_out oc
+
+let linkOrCopy src dst =
+    try link src dst
+    with Unix_error(_, _, _) -> copyFile src dst
+
+(* Returns true, having put the cached result at outputFile, on a hit *)
+let cacheLookup cacheDir key outputFile =
+    let cached = Filename.concat cacheDir (key ^ ".dbgcov") in
+    try
+        (try unlink outputFile with Unix_error(ENOENT, _, _) -> ());
+        (* fails if the entry is missing, e.g. evicted since we looked *)
+        linkOrCopy cached outputFile;
+        (* a time of 0.0 means now: this is what eviction orders by *)
+        (try utimes cached 0.0 0.0 with Unix_error(_, _, _) -> ());
+        true
+    with Unix_error(_, _, _) | Sys_error _ -> false
+
+let cacheEvict cacheDir maxSize =
+    let entries = List.fold_left (fun acc name ->
+        if not (Filename.check_suffix name ".dbgcov") then acc
+        else let path = Filename.concat cacheDir name in
+        try let st = stat path in (st.st_mtime, st.st_size, path) :: acc
+        with Unix_error(_, _, _) -> acc
+    ) [] (Array.to_list (Sys.readdir cacheDir)) in
+    let total = List.fold_left (fun acc (_, size, _) -> acc + size) 0 entries in
+    if total > maxSize then
+        (* Evict oldest first, down to 90% so we aren't doing this every time *)
+        let target = maxSize - maxSize / 10 in
+        ignore (List.fold_left (fun remaining (_, size, path) ->
+            if remaining <= target then remaining
+            else ((try unlink path with Unix_error(_, _, _) -> ()); remaining - size)
+        ) total (List.sort compare entries))
+
+let cacheInsert cacheDir key outputFile =
+    let tmp = Filename.concat cacheDir (Printf.sprintf "tmp.%d.%s" (getpid ()) key) in
+    try
+        linkOrCopy outputFile tmp;
+        rename tmp (Filename.concat cacheDir (key ^ ".dbgcov"));
+        cacheEvict cacheDir (cacheMaxSize ())
+    with Unix_error(_, _, _) | Sys_error _ ->
+        (try unlink tmp with Unix_error(_, _, _) -> ())
+
+(* Analyse inputFile into outputFile, going via the result cache if
+ * DBGCOV_CACHE_DIR is set, and return the exit status. Even when the tool
+ * parses the original source, cpp's output is what keys the cache, as it
+ * covers the headers too. Results from a server are not cached: the key
+ * describes our tool and options, not the server's. *)
+let analyse toolPath toolFlags useServer source inputFile outputFile =
+    match (try Some (Sys.getenv "DBGCOV_CACHE_DIR") with Not_found -> None) with
+        None -> fst (runTool toolPath toolFlags useServer source inputFile outputFile)
+      | Some cacheDir ->
+        (try mkdir cacheDir 0o755 with Unix_error(EEXIST, _, _) -> ());
+        let key = cacheKey toolPath toolFlags inputFile in
+        if cacheLookup cacheDir key outputFile then
+            (recordCacheStat cacheDir "hit"; 0)
+        else begin
+            recordCacheStat cacheDir "miss";
+            let status, ranTool = runTool toolPath toolFlags useServer source inputFile outputFile in
+            if status = 0 && ranTool then cacheInsert cacheDir key outputFile;
+            status
+        end
+
+(* Background analyses outlive the compile that started them, and may
+ * outlive make, so they can't take tokens from make's jobserver. Instead they
+ * share DBGCOV_ASYNC_JOBS slots (default: one per online CPU), each a lock
+ * file in <pending dir>/slots; the kernel drops a slot's lock if its holder
+ * dies. *)
+let asyncSlots () =
+    let online () =
+        let ic = open_process_in "getconf _NPROCESSORS_ONLN 2>/dev/null" in
+        let n = try int_of_string (input_line ic) with End_of_file | Failure _ -> 1 in
+        ignore (close_process_in ic);
+        n
+    in
+    max 1 (try int_of_string (Sys.getenv "DBGCOV_ASYNC_JOBS")
+           with Not_found | Failure _ -> online ())
+
+(* Block until we hold a slot, and return its descriptor, whose closing (or
+ * our exit) frees it; or None if the slots can't be used, in which case we
+ * just run. Take any free slot, or else wait for one chosen by our pid. *)
+let acquireSlot pendingDir =
+    let slotDir = Filename.concat pendingDir "slots" in
+    let n = asyncSlots () in
+    try
+        (try mkdir slotDir 0o755 with Unix_error(EEXIST, _, _) -> ());
+        let openSlot i =
+            let fd = openfile (Filename.concat slotDir (Printf.sprintf "%d.lock" i))
+                [O_RDWR; O_CREAT] 0o644 in
+            set_close_on_exec fd;
+            fd
+        in
+        let rec tryFrom i =
+            if i = n then None
+            else let fd = openSlot i in
+            try lockf fd F_TLOCK 0; Some fd
+            with Unix_error((EAGAIN | EACCES), _, _) -> close fd; tryFrom (i + 1)
+        in
+        match tryFrom 0 with
+            Some fd -> Some fd
+          | None ->
+                let fd = openSlot (getpid () mod n) in
+                let rec wait () =
+                    try lockf fd F_LOCK 0 with Unix_error(EINTR, _, _) -> wait ()
+                in
+                wait ();
+                Some fd
+    with Unix_error(_, _, _) -> None
+
+let releaseSlot slot =
+    match slot with
+        None -> ()
+      | Some fd -> (try close fd with Unix_error(_, _, _) -> ())
+
+(* Asynchronous mode, enabled by setting DBGCOV_ASYNC_DIR: rather than making
+ * the compiler wait, run the analysis in the background and exit at once.
+ * Each pending analysis is recorded in that directory as <name>.pending
+ * (output file name, then the analysing process's pid). It is removed on
+ * success, or renamed to <name>.failed, with its exit status appended and
+ * its stderr kept in <name>.log, on failure. bin/dbgcov-wait blocks until
+ * none are pending and reports failures. *)
+let spawnAsync pendingDir inputFile outputFile analyseFile =
+    (try mkdir pendingDir 0o755 with Unix_error(EEXIST, _, _) -> ());
+    let name = Printf.sprintf "%d-%.0f" (getpid ()) (gettimeofday () *. 1e6) in
+    let inDir suffix = Filename.concat pendingDir (name ^ suffix) in
+    let marker = inDir ".pending" in
+    let writeLine fd s = ignore (write_substring fd (s ^ "\n") 0 (String.length s + 1)) in
+    let markerFd = openfile marker [O_WRONLY; O_CREAT; O_EXCL] 0o644 in
+    writeLine markerFd outputFile;
+    (* The compiler may delete its preprocessed file (if not -save-temps)
+     * before we get to it, so keep our own link to it. *)
+    let savedInput = inDir ".i" in
+    linkOrCopy inputFile savedInput;
+    match fork () with
+        0 ->
+            (* We write our own pid, before anything we do can append to or
+             * rename the marker *)
+            writeLine markerFd (string_of_int (getpid ()));
+            close markerFd;
+            (* Detach from the compile, whose output make may be collecting *)
+            ignore (setsid ());
+            let nullFd = openfile "/dev/null" [O_RDONLY] 0 in
+            let logFd = openfile (inDir ".log") [O_WRONLY; O_CREAT; O_TRUNC] 0o644 in
+            dup2 nullFd stdin;
+            dup2 logFd stdout;
+            dup2 logFd stderr;
+            close nullFd;
+            close logFd;
+            let slot = acquireSlot pendingDir in
+            let status = try analyseFile savedInput with _ -> 1 in
+            releaseSlot slot;
+            (try unlink savedInput with Unix_error(_, _, _) -> ());
+            (if status = 0 then begin
+                (try unlink (inDir ".log") with Unix_error(_, _, _) -> ());
+                (try unlink marker with Unix_error(_, _, _) -> ())
+            end else
+                try
+                    let fd = openfile marker [O_WRONLY; O_APPEND] 0 in
+                    writeLine fd ("exit status " ^ string_of_int status);
+                    close fd;
+                    rename marker (inDir ".failed")
+                with Unix_error(_, _, _) -> ());
+            exit status
+      | _ ->
+            close markerFd;
+            exit 0
+
+(* DBGCOV_PCH_DIR mode: rather than re-parse all of cpp's output, the tool
+ * parses the original source, given the options that affect preprocessing,
+ * with the source's leading #includes precompiled. PCHs are cached in that
+ * directory and shared by every source of the build with the same leading
+ * #includes and options. *)
+let preprocessingOptionPrefixes =
+    ["-I"; "-D"; "-U"; "-include"; "-imacros"; "-isystem"; "-iquote"; "-idirafter"; "-std="]
+
+let startsWith prefix s =
+    String.length s >= String.length prefix && String.sub s 0 (String.length prefix) = prefix
+
+let preprocessingOptionsOf argChunks =
+    List.flatten (List.filter (fun argChunk -> match argChunk with
+        first :: _ -> List.exists (fun prefix -> startsWith prefix first) preprocessingOptionPrefixes
+                      || List.mem first ["-ansi"; "-nostdinc"; "-undef"]
+      | [] -> false
+    ) argChunks)
+
+(* The C source being preprocessed, if it is a file we can parse ourselves *)
+let sourceFileOf argChunks =
+    List.fold_left (fun acc argChunk -> match argChunk with
+        [arg] when not (startsWith "-" arg) && Filename.check_suffix arg ".c"
+                   && Sys.file_exists arg -> Some arg
+      | _ -> acc
+    ) None argChunks
+
 let () =
     let argList = Array.to_list Sys.argv in
     let (argChunks, basicInfo) = scanAndChunkCppArgs argList in
@@ -37,9 +336,39 @@ let () =
                 then Filename.concat Filename.current_dir_name "dbgcov-tool"
                 else Filename.concat (Filename.dirname Sys.executable_name) "dbgcov-tool"
             in
+            (* Extra tool options, e.g. "-output-format=binary", can be
+             * passed through the environment. *)
+            let toolFlags = try Str.split (Str.regexp "[ \t]+") (Sys.getenv "DBGCOV_TOOL_FLAGS")
+                with Not_found -> []
+            in
             let the_output_file_name = the_input_file_name ^ ".dbgcov" in
-            let outfd = Unix.openfile the_output_file_name [O_RDWR; O_CREAT; O_TRUNC] 0o640 in
-               ((output_string Pervasives.stderr ("output should go to " ^ the_output_file_name ^ "\n");
-                 Pervasives.flush Pervasives.stderr);
-                 dup2 outfd stdout);
-            execv toolPath [|toolPath; the_input_file_name ; "--"|]
+            (* With DBGCOV_INCREMENTAL set, each output keeps the per-function
+             * regions of its last run alongside it, so that rebuilding after
+             * a small edit only re-analyses the functions that changed. A
+             * server can't be told to do this, so we run the tool ourselves. *)
+            let incremental = try ignore (Sys.getenv "DBGCOV_INCREMENTAL"); true with Not_found -> false in
+            let toolFlags = if incremental
+                then toolFlags @ ["-incremental-cache=" ^ the_output_file_name ^ ".functions"]
+                else toolFlags
+            in
+            let useServer = not incremental in
+            (* With DBGCOV_PCH_DIR set, have the tool parse the original
+             * source if there is one; if not (e.g. when preprocessing stdin),
+             * analyse cpp's output as usual. *)
+            let source, toolFlags =
+                match (try Some (Sys.getenv "DBGCOV_PCH_DIR") with Not_found -> None) with
+                    None -> None, toolFlags
+                  | Some pchDir ->
+                    (* the first chunk is the cpp command itself *)
+                    let cppArgChunks = List.tl argChunks in
+                    match sourceFileOf cppArgChunks with
+                        None -> None, toolFlags
+                      | Some sourceFile ->
+                            Some (sourceFile, preprocessingOptionsOf cppArgChunks),
+                            toolFlags @ ["-pch-dir=" ^ pchDir]
+            in
+            match (try Some (Sys.getenv "DBGCOV_ASYNC_DIR") with Not_found -> None) with
+                None -> exit (analyse toolPath toolFlags useServer source the_input_file_name the_output_file_name)
+              | Some pendingDir ->
+                spawnAsync pendingDir the_input_file_name the_output_file_name
+                    (fun inputFile -> analyse toolPath toolFlags useServer source inputFile the_output_file_name)
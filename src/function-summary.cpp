@@ -0,0 +1,77 @@
+#include "function-summary.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace llvm;
+
+namespace dbgcov {
+
+void FunctionSummarySink::BeginFunction(StringRef name, StringRef path,
+                                        unsigned line) {
+  WriteFunction();
+  Name = name.str();
+  Path = path.str();
+  FirstLine = line;
+}
+
+void FunctionSummarySink::AddLines(BitVector &bits, const Region &region) {
+  // Regions don't start before their function, but be safe
+  unsigned begin = std::max(region.BeginLine, FirstLine) - FirstLine;
+  if (region.EndLine < FirstLine || region.EndLine - FirstLine < begin)
+    return;
+  unsigned end = region.EndLine - FirstLine + 1;
+  if (bits.size() < end)
+    bits.resize(end);
+  bits.set(begin, end);
+}
+
+void FunctionSummarySink::AddRegion(const Region &region) {
+  if (Name.empty() || region.Path != Path)
+    return;
+  if (region.Kind == RegionKind::Computation) {
+    AddLines(Computation, region);
+    return;
+  }
+  auto inserted = VariableIds.insert(
+      std::make_pair(region.Detail, unsigned(Variables.size())));
+  if (inserted.second)
+    Variables.emplace_back(region.Detail.str(), VariableLines());
+  VariableLines &lines = Variables[inserted.first->getValue()].second;
+  switch (region.Kind) {
+  case RegionKind::DeclScope:
+    AddLines(lines.Scope, region);
+    break;
+  case RegionKind::MustBeDefined:
+    AddLines(lines.Must, region);
+    break;
+  case RegionKind::MayBeDefined:
+    AddLines(lines.May, region);
+    break;
+  case RegionKind::Computation:
+    break;
+  }
+}
+
+void FunctionSummarySink::WriteFunction() {
+  if (!Name.empty()) {
+    OS << "function\t" << Path << ":" << FirstLine << "\t" << Name << "\t"
+       << Computation.count() << "\t" << Variables.size() << "\n";
+    for (auto &variable : Variables) {
+      VariableLines &lines = variable.second;
+      BitVector mustWithComputation = lines.Must;
+      mustWithComputation &= Computation;
+      OS << "variable\t" << variable.first << "\t" << lines.Scope.count()
+         << "\t" << lines.Must.count() << "\t" << mustWithComputation.count()
+         << "\t" << lines.May.count() << "\n";
+    }
+  }
+  Name.clear();
+  Computation.clear();
+  VariableIds.clear();
+  Variables.clear();
+}
+
+void FunctionSummarySink::Finish() { WriteFunction(); }
+
+} // namespace dbgcov
@@ -0,0 +1,62 @@
+#ifndef DBGCOV_FUNCTION_SUMMARY_H
+#define DBGCOV_FUNCTION_SUMMARY_H
+
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "regions.h"
+
+namespace dbgcov {
+
+/* `-output-format=summary`: instead of the regions, a few numbers for each
+ * function definition, built from line bitsets as its regions arrive:
+ *
+ *   function <path>:<line> <name> <computation lines> <variables>
+ *   variable <name> <scope lines> <must lines> <must lines with computation>
+ *            <may lines>
+ *
+ * (tab-separated), with a `variable` line for each parameter and local of the
+ * function above it, in order of first appearance. Each count is of distinct
+ * lines in the function's file covered by the function's regions of the
+ * corresponding kind (`Computation`, or the variable's `DeclScope`,
+ * `MustBeDefined` and `MayBeDefined`), from each region's begin line to its
+ * end line; so they can also be had from the full output. Regions in other
+ * files (from an `#include` inside a function body) aren't counted.
+ */
+class FunctionSummarySink : public RegionSink {
+public:
+  explicit FunctionSummarySink(llvm::raw_ostream &OS) : OS(OS) {}
+  void BeginFunction(llvm::StringRef name, llvm::StringRef path,
+                     unsigned line) override;
+  void AddRegion(const Region &region) override;
+  void Finish() override;
+
+private:
+  // Lines relative to `FirstLine`
+  struct VariableLines {
+    llvm::BitVector Scope;
+    llvm::BitVector Must;
+    llvm::BitVector May;
+  };
+
+  void AddLines(llvm::BitVector &bits, const Region &region);
+  void WriteFunction();
+
+  llvm::raw_ostream &OS;
+  // The function whose regions are arriving, if any
+  std::string Name;
+  std::string Path;
+  unsigned FirstLine = 0;
+  llvm::BitVector Computation;
+  llvm::StringMap<unsigned> VariableIds;
+  std::vector<std::pair<std::string, VariableLines>> Variables;
+};
+
+} // namespace dbgcov
+
+#endif
@@ -0,0 +1,157 @@
+#include "incremental.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace dbgcov {
+
+static const char CacheHeader[] = "dbgcov-function-cache 1";
+
+static Error MalformedCache(StringRef path, unsigned lineNumber) {
+  return createStringError(inconvertibleErrorCode(),
+                           "%s:%u: malformed function cache",
+                           path.str().c_str(), lineNumber);
+}
+
+Error FunctionRegionCache::Load(StringRef path) {
+  auto buffer = MemoryBuffer::getFile(path);
+  if (!buffer) {
+    if (buffer.getError() == std::errc::no_such_file_or_directory)
+      return Error::success();
+    return createStringError(buffer.getError(), "%s: %s", path.str().c_str(),
+                             buffer.getError().message().c_str());
+  }
+
+  SmallVector<StringRef, 8> fields;
+  Entry *entry = nullptr;
+  unsigned remaining = 0;
+  unsigned lineNumber = 0;
+  StringRef rest = (*buffer)->getBuffer();
+  while (!rest.empty()) {
+    StringRef line;
+    std::tie(line, rest) = rest.split('\n');
+    if (++lineNumber == 1) {
+      if (line != CacheHeader)
+        return MalformedCache(path, lineNumber);
+      continue;
+    }
+
+    fields.clear();
+    line.split(fields, '\t');
+    if (fields[0] == "F" && fields.size() == 4 && !remaining) {
+      Entry &added = Previous[fields[1]];
+      added.Regions.clear();
+      if (fields[2].getAsInteger(10, added.StartLine) ||
+          fields[3].getAsInteger(10, remaining))
+        return MalformedCache(path, lineNumber);
+      added.Regions.reserve(remaining);
+      entry = &added;
+    } else if (fields[0] == "R" && fields.size() == 8 && remaining) {
+      Region region;
+      if (!ParseRegionKind(fields[1], region.Kind) ||
+          fields[3].getAsInteger(10, region.BeginLine) ||
+          fields[4].getAsInteger(10, region.BeginColumn) ||
+          fields[5].getAsInteger(10, region.EndLine) ||
+          fields[6].getAsInteger(10, region.EndColumn))
+        return MalformedCache(path, lineNumber);
+      region.Path = Strings.save(fields[2]);
+      region.Detail = Strings.save(fields[7]);
+      entry->Regions.push_back(region);
+      --remaining;
+    } else {
+      return MalformedCache(path, lineNumber);
+    }
+  }
+  // A truncated file is as good as none: better a full run than a wrong one
+  if (!lineNumber || remaining)
+    return MalformedCache(path, lineNumber);
+  return Error::success();
+}
+
+Error FunctionRegionCache::Save(StringRef path) const {
+  std::error_code error;
+  raw_fd_ostream OS(path, error);
+  if (error)
+    return createStringError(error, "%s: %s", path.str().c_str(),
+                             error.message().c_str());
+
+  OS << CacheHeader << "\n";
+  for (const auto &function : Current) {
+    const Entry &entry = function.getValue();
+    OS << "F\t" << function.getKey() << "\t" << entry.StartLine << "\t"
+       << entry.Regions.size() << "\n";
+    for (const Region &region : entry.Regions)
+      OS << "R\t" << GetRegionKindName(region.Kind) << "\t" << region.Path
+         << "\t" << region.BeginLine << "\t" << region.BeginColumn << "\t"
+         << region.EndLine << "\t" << region.EndColumn << "\t"
+         << region.Detail << "\n";
+  }
+  OS.close();
+  if (OS.has_error())
+    return createStringError(OS.error(), "%s: %s", path.str().c_str(),
+                             OS.error().message().c_str());
+  return Error::success();
+}
+
+Region FunctionRegionCache::Shift(const Region &region, int delta) {
+  Region shifted = region;
+  shifted.BeginLine += delta;
+  shifted.EndLine += delta;
+  if (region.Kind == RegionKind::Computation)
+    return shifted;
+
+  // Extended variable names end with the line of the declaration, which is
+  // inside the function and so has moved with it
+  size_t colon = region.Detail.rfind(':');
+  unsigned declLine;
+  if (colon == StringRef::npos ||
+      region.Detail.substr(colon + 1).getAsInteger(10, declLine))
+    return shifted;
+  SmallString<64> detail(region.Detail.substr(0, colon + 1));
+  raw_svector_ostream(detail) << declLine + delta;
+  shifted.Detail = Strings.save(detail.str());
+  return shifted;
+}
+
+bool FunctionRegionCache::Replay(StringRef fingerprint, unsigned startLine,
+                                 RegionSink &sink) {
+  auto found = Previous.find(fingerprint);
+  if (found == Previous.end())
+    return false;
+
+  const Entry &previous = found->getValue();
+  int delta = int(startLine) - int(previous.StartLine);
+  ++Replayed;
+  if (delta)
+    ++Shifted;
+  Entry &current = Current[fingerprint];
+  current.StartLine = startLine;
+  current.Regions.clear();
+  current.Regions.reserve(previous.Regions.size());
+  for (const Region &region : previous.Regions) {
+    current.Regions.push_back(delta ? Shift(region, delta) : region);
+    sink.AddRegion(current.Regions.back());
+  }
+  return true;
+}
+
+void FunctionRegionCache::Add(StringRef fingerprint, unsigned startLine,
+                              ArrayRef<Region> regions) {
+  ++Added;
+  Entry &current = Current[fingerprint];
+  current.StartLine = startLine;
+  current.Regions.clear();
+  current.Regions.reserve(regions.size());
+  // The regions' strings belong to this translation unit; keep our own copies
+  for (Region region : regions) {
+    region.Path = Strings.save(region.Path);
+    region.Detail = Strings.save(region.Detail);
+    current.Regions.push_back(region);
+  }
+}
+
+} // namespace dbgcov
@@ -0,0 +1,99 @@
+#ifndef DBGCOV_INCREMENTAL_H
+#define DBGCOV_INCREMENTAL_H
+
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/StringSaver.h"
+
+#include "regions.h"
+
+namespace dbgcov {
+
+/* The regions of each function definition from the previous run over a
+ * translation unit, for `-incremental-cache`. Functions are keyed by a
+ * fingerprint that changes whenever their regions could, apart from moving
+ * up or down the file; their regions are then replayed shifted by however
+ * many lines the function has moved.
+ *
+ * On disk this is a text file:
+ *
+ *   dbgcov-function-cache 1
+ *   F <fingerprint> <start line> <region count>
+ *   R <kind> <path> <begin line> <begin col> <end line> <end col> <detail>
+ *   ...
+ *
+ * with tab-separated fields and one R line per region of the function above.
+ */
+class FunctionRegionCache {
+public:
+  FunctionRegionCache() : Strings(Alloc) {}
+
+  // Load the previous run's cache. A missing file is just an empty cache.
+  llvm::Error Load(llvm::StringRef path);
+  // Save the functions seen in this run (by `Replay` or `Add`)
+  llvm::Error Save(llvm::StringRef path) const;
+
+  // If the previous run saw `fingerprint`, send its regions to `sink`, moved
+  // to begin at `startLine`, and return true
+  bool Replay(llvm::StringRef fingerprint, unsigned startLine,
+              RegionSink &sink);
+  // Remember the regions just found for a function that wasn't replayed
+  void Add(llvm::StringRef fingerprint, unsigned startLine,
+           llvm::ArrayRef<Region> regions);
+
+  // For `-stats`: functions replayed so far (and how many of those had moved),
+  // and functions analysed and added
+  unsigned GetReplayedCount() const { return Replayed; }
+  unsigned GetShiftedCount() const { return Shifted; }
+  unsigned GetAddedCount() const { return Added; }
+
+private:
+  struct Entry {
+    unsigned StartLine = 0;
+    std::vector<Region> Regions;
+  };
+
+  Region Shift(const Region &region, int delta);
+
+  llvm::BumpPtrAllocator Alloc;
+  llvm::UniqueStringSaver Strings;
+  llvm::StringMap<Entry> Previous;
+  llvm::StringMap<Entry> Current;
+  unsigned Replayed = 0;
+  unsigned Shifted = 0;
+  unsigned Added = 0;
+};
+
+// Passes regions on to another sink, keeping a copy while recording
+class RecordingRegionSink : public RegionSink {
+public:
+  explicit RecordingRegionSink(RegionSink &Next) : Next(Next) {}
+  void AddRegion(const Region &region) override {
+    Next.AddRegion(region);
+    Recorded.push_back(region);
+  }
+  void BeginFunction(llvm::StringRef name, llvm::StringRef path,
+                     unsigned line) override {
+    Next.BeginFunction(name, path, line);
+  }
+  void Finish() override { Next.Finish(); }
+
+  std::vector<Region> TakeRecorded() {
+    std::vector<Region> recorded;
+    recorded.swap(Recorded);
+    return recorded;
+  }
+
+private:
+  RegionSink &Next;
+  std::vector<Region> Recorded;
+};
+
+} // namespace dbgcov
+
+#endif
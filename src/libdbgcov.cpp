@@ -0,0 +1,161 @@
+#include "libdbgcov.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef USE_STD_UNIQUE_PTR
+#include <memory>
+#endif
+
+#include "clang/AST/ASTConsumer.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+#include "analysis.h"
+
+using namespace clang;
+using namespace clang::tooling;
+using namespace llvm;
+using dbgcov::RegionSink;
+#ifdef USE_STD_UNIQUE_PTR
+using std::make_unique;
+#else
+using llvm::make_unique;
+#endif
+
+namespace {
+
+// For each source file provided to the tool, a new FrontendAction is created.
+class DbgCovFrontendAction : public ASTFrontendAction {
+public:
+  explicit DbgCovFrontendAction(const RegionSinkFactory &CreateSink)
+      : CreateSink(CreateSink) {}
+  std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+                                                 StringRef file) override {
+    // The consumer then decides which bodies to skip
+    if (HeaderFunctions == HeaderFunctionMode::Skip)
+      CI.getFrontendOpts().SkipFunctionBodies = true;
+    return CreateDbgCovConsumer(CI, CreateSink(), file);
+  }
+
+  // Covers parsing and Sema, which our traversal is interleaved with
+  void ExecuteAction() override {
+    llvm::TimeTraceScope traceScope("DbgCov parse", getCurrentFile());
+    ASTFrontendAction::ExecuteAction();
+  }
+
+private:
+  const RegionSinkFactory &CreateSink;
+};
+
+class DbgCovActionFactory : public FrontendActionFactory {
+public:
+  explicit DbgCovActionFactory(RegionSinkFactory CreateSink)
+      : CreateSink(std::move(CreateSink)) {}
+  std::unique_ptr<FrontendAction> create() override {
+    return make_unique<DbgCovFrontendAction>(CreateSink);
+  }
+
+private:
+  RegionSinkFactory CreateSink;
+};
+
+// Passes regions on to a sink belonging to the caller
+class ReferenceRegionSink : public RegionSink {
+public:
+  explicit ReferenceRegionSink(RegionSink &Next) : Next(Next) {}
+  void AddRegion(const dbgcov::Region &region) override {
+    Next.AddRegion(region);
+  }
+  void BeginFunction(StringRef name, StringRef path, unsigned line) override {
+    Next.BeginFunction(name, path, line);
+  }
+  void Finish() override { Next.Finish(); }
+
+private:
+  RegionSink &Next;
+};
+
+// Copies regions into a `RegionTable`, interning their strings
+class TableRegionSink : public RegionSink {
+public:
+  explicit TableRegionSink(dbgcov::RegionTable &Table) : Table(Table) {}
+  void AddRegion(const dbgcov::Region &region) override {
+    dbgcov::RegionRecord record;
+    record.Kind = region.Kind;
+    record.File = Intern(Files, Table.Files, region.Path);
+    record.BeginLine = region.BeginLine;
+    record.BeginColumn = region.BeginColumn;
+    record.EndLine = region.EndLine;
+    record.EndColumn = region.EndColumn;
+    record.Detail = Intern(Details, Table.Details, region.Detail);
+    Table.Regions.push_back(record);
+  }
+
+private:
+  static uint32_t Intern(StringMap<uint32_t> &indices,
+                         std::vector<std::string> &strings, StringRef string) {
+    auto inserted = indices.insert(std::make_pair(string, strings.size()));
+    if (inserted.second)
+      strings.push_back(string.str());
+    return inserted.first->second;
+  }
+
+  dbgcov::RegionTable &Table;
+  StringMap<uint32_t> Files;
+  StringMap<uint32_t> Details;
+};
+
+} // namespace
+
+std::unique_ptr<FrontendActionFactory>
+CreateDbgCovActionFactory(RegionSinkFactory createSink) {
+  return make_unique<DbgCovActionFactory>(std::move(createSink));
+}
+
+Error dbgcov::AnalyseSource(const SourceInput &input, RegionSink &sink) {
+  // Each call has its own file system view, so its own working directory
+  IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS(
+      llvm::vfs::createPhysicalFileSystem().release());
+  SmallString<128> workingDirectory(input.WorkingDirectory);
+  if (workingDirectory.empty()) {
+    if (std::error_code error = llvm::sys::fs::current_path(workingDirectory))
+      return createStringError(error, "current directory: %s",
+                               error.message().c_str());
+  }
+  if (std::error_code error = FS->setCurrentWorkingDirectory(workingDirectory))
+    return createStringError(error, "%s: %s", workingDirectory.c_str(),
+                             error.message().c_str());
+  // Mapped files are looked up by absolute path
+  SmallString<128> path(input.Path);
+  FS->makeAbsolute(path);
+
+  FixedCompilationDatabase Compilations(workingDirectory, input.CompilerArgs);
+  ClangTool Tool(Compilations, {path.str().str()},
+                 std::make_shared<PCHContainerOperations>(), FS);
+  if (input.InMemory)
+    Tool.mapVirtualFile(path, input.Contents);
+  DbgCovActionFactory ActionFactory([&sink]() -> std::unique_ptr<RegionSink> {
+    return make_unique<ReferenceRegionSink>(sink);
+  });
+  if (Tool.run(&ActionFactory))
+    return createStringError(inconvertibleErrorCode(),
+                             "%s: analysis failed", input.Path.c_str());
+  return Error::success();
+}
+
+Expected<dbgcov::RegionTable>
+dbgcov::AnalyseSource(const SourceInput &input) {
+  RegionTable table;
+  TableRegionSink sink(table);
+  if (Error error = AnalyseSource(input, sink))
+    return error;
+  return table;
+}
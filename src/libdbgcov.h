@@ -0,0 +1,78 @@
+#ifndef DBGCOV_LIBDBGCOV_H
+#define DBGCOV_LIBDBGCOV_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llvm/Support/Error.h"
+
+#include "regions.h"
+
+/* libdbgcov: the analysis of `dbgcov-tool`, in process. Link with
+ * `libdbgcov.a` and the Clang and LLVM libraries `dbgcov-tool` links with.
+ *
+ *   dbgcov::SourceInput input;
+ *   input.Path = "foo.i";
+ *   input.CompilerArgs = {"-std=gnu11"};
+ *   auto regions = dbgcov::AnalyseSource(input);
+ *
+ * Only this header (and `regions.h`, for `RegionKind` and sinks) is meant for
+ * callers; nothing here depends on Clang's headers.
+ */
+
+namespace dbgcov {
+
+// Set analysis options, as `<option>=<value>` (or `<option>` for a flag) for
+// any `dbgcov-tool` analysis option without its leading `-`, e.g.
+// `definedness=cfg`. Options hold for the whole process until the next call,
+// which first resets them all to their defaults.
+llvm::Error SetAnalysisOptions(const std::vector<std::string> &options);
+
+// What to analyse, and how to compile it
+struct SourceInput {
+  // Relative to `WorkingDirectory`, or to the current directory if that is
+  // empty
+  std::string Path;
+  // Analyse this rather than the file at `Path`, if `InMemory` is set; `Path`
+  // still names it, in regions and for resolving its `#include`s
+  bool InMemory = false;
+  std::string Contents;
+  // Arguments for the compiler, as after `--` on the `dbgcov-tool` command
+  // line
+  std::vector<std::string> CompilerArgs;
+  std::string WorkingDirectory;
+};
+
+// Send the regions of `input` to `sink`, then call its `Finish`. Region
+// strings last only until `Finish` returns. Separate calls may run
+// concurrently, each with its own sink.
+llvm::Error AnalyseSource(const SourceInput &input, RegionSink &sink);
+
+// A region whose strings are indices into the tables of its `RegionTable`
+struct RegionRecord {
+  RegionKind Kind;
+  uint32_t File;
+  uint32_t BeginLine;
+  uint32_t BeginColumn;
+  uint32_t EndLine;
+  uint32_t EndColumn;
+  // The statement type for `Computation` regions, and the variable key
+  // (`<function>, <variable>, decl <file>:<line>`) otherwise
+  uint32_t Detail;
+};
+
+// The regions of one translation unit, in the order they were found. Each
+// distinct path and detail appears once in its table, so equal indices mean
+// equal strings.
+struct RegionTable {
+  std::vector<std::string> Files;
+  std::vector<std::string> Details;
+  std::vector<RegionRecord> Regions;
+};
+
+llvm::Expected<RegionTable> AnalyseSource(const SourceInput &input);
+
+} // namespace dbgcov
+
+#endif
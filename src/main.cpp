@@ -1,24 +1,18 @@
-#include <cstring>
+#include <algorithm>
+#include <atomic>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 #ifdef USE_STD_UNIQUE_PTR
 #include <memory>
 #endif
 
-#include "clang/AST/AST.h"
-#include "clang/AST/ASTTypeTraits.h"
 #include "clang/AST/ASTConsumer.h"
-#include "clang/AST/Decl.h"
-#ifdef HAVE_CLANG_AST_PARENTMAPCONTEXT_H
-#include "clang/AST/ParentMapContext.h"
-#endif
-#include "clang/AST/RecursiveASTVisitor.h"
-#include "clang/Basic/SourceLocation.h"
-#include "clang/Basic/SourceManager.h"
 #include "clang/Frontend/ASTConsumers.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendActions.h"
-#include "clang/Rewrite/Core/Rewriter.h"
 #include "clang/Tooling/Tooling.h"
 #include "clang/Tooling/CommonOptionsParser.h" // TODO: remove
 #include "llvm/ADT/SmallString.h"
@@ -31,489 +25,240 @@
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/Program.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+#include "analysis.h"
+#include "prefix-pch.h"
+#include "server.h"
 
 using namespace clang;
 using namespace clang::driver;
 using namespace clang::tooling;
 using namespace llvm;
-#ifdef HAVE_DYNTYPEDNODE_IN_CLANG_NAMESPACE
-using clang::DynTypedNode;
-#else
-using clang::ast_type_traits::DynTypedNode;
-#endif
-#ifdef USE_STD_UNIQUE_PTR
-using std::make_unique;
-#else
-using llvm::make_unique;
-#endif
-
-// `dyn_cast_if_present` added in LLVM 15, replaces `dyn_cast_or_null`
-#ifdef HAVE_DYN_CAST_IF_PRESENT
-#define dyn_cast_if_present dyn_cast_if_present
-#else
-#define dyn_cast_if_present dyn_cast_or_null
-#endif
-
-class DbgCovASTVisitor : public RecursiveASTVisitor<DbgCovASTVisitor> {
-public:
-  DbgCovASTVisitor(Rewriter &R, ASTContext &C) : TheRewriter(R), TheContext(C) {}
-
-  // Utilities
-
-  PresumedLoc GetPresumedLocation(const SourceLocation &sLoc) {
-    const auto &mgr = TheRewriter.getSourceMgr();
-    assert(sLoc.isFileID() && "Non-file location");
-    PresumedLoc pLoc = mgr.getPresumedLoc(sLoc);
-    assert(pLoc.isValid() && "Invalid location");
-    return pLoc;
-  }
-
-  std::string GetExtendedName(const NamedDecl &decl) {
-    const auto &mgr = TheRewriter.getSourceMgr();
-    // TODO: Support C++ `BlockDecl`s
-    const auto *functionDecl = cast<FunctionDecl>(decl.getDeclContext());
-
-    PresumedLoc declLoc = mgr.getPresumedLoc(decl.getLocation());
-    assert(declLoc.isValid() && "Invalid decl location");
-
-    // The precise name format here must match `debuginfo-quality` so we can match
-    // data across both tools.
-    // <function>, <variable>, decl <file>:<line>
-    std::string name;
-    raw_string_ostream stream(name);
-    stream << functionDecl->getDeclName() << ", " << decl.getDeclName()
-           << ", decl " << llvm::sys::path::filename(declLoc.getFilename())
-           << ":" << declLoc.getLine();
-    return name;
-  }
-
-  void PrintLocation(raw_ostream &stream, const PresumedLoc &loc) {
-    SmallString<128> filePath(loc.getFilename());
-    std::error_code error = llvm::sys::fs::make_absolute(filePath);
-    assert(!error && "Unable to make absolute path");
-    stream << filePath << ":" << loc.getLine() << ":"
-           << loc.getColumn();
-  }
-
-  void PrintRegion(raw_ostream &stream, const SourceLocation &begin,
-                   const SourceLocation &end, const Twine &kind,
-                   const Twine &detail, bool beginNextLine) {
-    const auto &beginLoc = GetPresumedLocation(begin);
-    const auto &endLoc = GetPresumedLocation(end);
-    if (strcmp(beginLoc.getFilename(), endLoc.getFilename())) {
-      llvm::errs() << "Warning: Ignoring multi-file region\n";
-      PrintLocation(llvm::errs(), beginLoc);
-      llvm::errs() << "\n";
-      PrintLocation(llvm::errs(), endLoc);
-      llvm::errs() << "\n" << kind << "\n" << detail << "\n";
-      return;
-    }
-    if (beginLoc.getLine() > endLoc.getLine()) {
-      llvm::errs() << "Error: Invalid region (begin after end)\n";
-      PrintLocation(llvm::errs(), beginLoc);
-      llvm::errs() << "\n";
-      PrintLocation(llvm::errs(), endLoc);
-      llvm::errs() << "\n" << kind << "\n" << detail << "\n";
-    }
-    assert(beginLoc.getLine() <= endLoc.getLine());
-    // Ensure that we don't move the begin line past the end line for
-    // single-line regions (e.g. macro invocations)
-    if (beginLoc.getLine() == endLoc.getLine())
-      beginNextLine = false;
-    if (beginNextLine) {
-      PrintLocation(stream,
-                    PresumedLoc(beginLoc.getFilename(), beginLoc.getFileID(),
-                                beginLoc.getLine() + 1, 0,
-                                beginLoc.getIncludeLoc()));
-    } else {
-      PrintLocation(stream, beginLoc);
-    }
-    stream << "\t";
-    PrintLocation(stream, endLoc);
-    stream << "\t" << kind << "\t" << detail << "\n";
-  }
-
-  template <typename NodeT> const Stmt *GetParentStmt(const NodeT *expr) {
-    const Stmt *parentStmt = nullptr;
-
-    // Look for the nearest `Stmt` ancestor
-    auto &parentMap = TheContext.getParentMapContext();
-    auto parents = parentMap.getParents(*expr);
-    while (!parents.empty()) {
-      parentStmt = parents[0].template get<Stmt>();
-      // C is statement-oriented, so all `Expr`s are also `Stmt`s
-      // In this case, we only want `Stmt`s that are _not_ `Expr`s
-      if (parentStmt && !isa<Expr>(parentStmt))
-        break;
-      parents = parentMap.getParents(parents[0]);
-    }
-
-    return parentStmt;
-  }
-
-  void ReportDeclRefExprAsDefined(const DeclRefExpr *declRefExpr,
-                                  const Stmt *stmtForRegionStart,
-                                  const Twine &regionKind,
-                                  bool beginNextLine) {
-    const auto *namedDecl = cast<NamedDecl>(declRefExpr->getDecl());
-    // Only examine variables inside functions
-    if (!isa<FunctionDecl>(namedDecl->getDeclContext()))
-      return;
-    // llvm::errs() << "Report for `" << namedDecl->getDeclName() << "`\n";
-    // s->dump();
-
-    const auto *parentStmt = GetParentStmt(stmtForRegionStart);
-    // Only examine variables within some kind of `Stmt`, such as a continuing
-    // `CompoundStmt` or blocks with associated declarations (e.g. `ForStmt`)
-    if (!parentStmt)
-      return;
-    // parentStmt->dump();
-
-    PrintRegion(llvm::outs(), stmtForRegionStart->getEndLoc(),
-                parentStmt->getEndLoc(), regionKind,
-                GetExtendedName(*namedDecl), beginNextLine);
-  }
 
-  void ReportTreeAsDefined(const Expr *tree, const Stmt *stmtForRegionStart,
-                           const Twine &regionKind, bool beginNextLine) {
-    SmallVector<const Stmt *, 8> workQueue;
-    // Find all `DeclRefExpr`s within `tree`
-    workQueue.push_back(tree);
-    while (!workQueue.empty()) {
-      const auto *node = workQueue.back();
-      workQueue.pop_back();
-      // Add any children to the work queue
-      for (const auto *child : node->children())
-        workQueue.push_back(child);
-      // Report `DeclRefExpr` if found
-      if (!isa<DeclRefExpr>(node))
-        continue;
-      const auto *declRefExpr = cast<DeclRefExpr>(node);
-      ReportDeclRefExprAsDefined(declRefExpr, stmtForRegionStart, regionKind,
-                                 beginNextLine);
-    }
-  }
-
-  // Nodes with standardised handling
-
-  /* What can we "visit" using RecursiveASTVisitor?
-     - attributes or specific classes thereof
-     - statements or specific classes thereof -- expressions are a kind of statement!
-     - specific unary and binary operators
-     - compound assignments
-     - types
-     - decls
-
-     Of these, I *think* it is only expressions that contain code that executes at run time.
-     So let's focus on those... what kinds of expression are there? Expr is the base.
-     Problem: the taxonomy of statements/expressions is liable to change
-     across clang versions.
-
-     Let's use a macroised list to generate our visitors
-   */
-#define STMTS_TO_PRINT(v) \
-  v(ArraySubscriptExpr) \
-  v(CXXConstructExpr) \
-  v(CXXDefaultArgExpr) \
-  v(CXXFoldExpr) \
-  v(CXXInheritedCtorInitExpr) \
-  v(CXXNewExpr) \
-  v(CXXPseudoDestructorExpr) \
-  v(CXXScalarValueInitExpr) \
-  v(CXXTypeidExpr) \
-  /* v(CastExpr) */ /* too many artificial instances of this */ \
-  v(ChooseExpr) \
-  v(DeclRefExpr) /* may be too general, requires excluding constants */ \
-  v(GenericSelectionExpr) \
-  v(LambdaExpr) \
-  v(MaterializeTemporaryExpr) \
-  v(MemberExpr) \
-  v(OpaqueValueExpr) \
-  v(PseudoObjectExpr) \
-  v(UnaryOperator) \
-  v(VAArgExpr) \
-  v(ReturnStmt)
-
-#define VISITOR_METHOD_PRINT(type, var)                                        \
-  PrintRegion(llvm::outs(), var->getBeginLoc(), var->getEndLoc(),              \
-              "Computation", #type, /* beginNextLine = */ false);
-
-#define VISITOR_METHOD(type) \
-  bool Visit ## type (type *s) { \
-    VISITOR_METHOD_PRINT(type, s) \
-    return true; \
-  } /* end VisitExpr */
-
-  STMTS_TO_PRINT(VISITOR_METHOD)
-
-  // Some nodes have non-body subexpressions
-
-  bool VisitDoStmt(DoStmt *s) {
-    if (const auto *cond = s->getCond()) {
-      VISITOR_METHOD_PRINT(DoStmt.Cond, cond)
-    }
-    return true;
-  }
-
-  bool VisitForStmt(ForStmt *s) {
-    if (const auto *init = s->getInit()) {
-      VISITOR_METHOD_PRINT(ForStmt.Init, init)
-    }
-    if (const auto *cond = s->getCond()) {
-      VISITOR_METHOD_PRINT(ForStmt.Cond, cond)
-    }
-    if (const auto *inc = s->getInc()) {
-      VISITOR_METHOD_PRINT(ForStmt.Inc, inc)
+/* Clang wants a "compilations database" and a "source path list".
+ * We want to mimic the gcc command-line interface; since so (mostly)
+ * does clang, we should be able to get what we want from libclang
+ * code. How does it parse its argc and argv? Where is the clang
+ * main(), even? It's in clang/tools/driver.
+ * HACK: for now, don't mimic gcc's command line. Just use the
+ * LLVM common options format, and let our wrapper script adapt.
+ * (But see Attic/options.cpp for a partial attempt at the original.)
+ */
+static llvm::cl::opt<std::string> ServerSocket(
+    "server",
+    llvm::cl::desc("Serve analysis requests on the given Unix socket, using "
+                   "the compiler options given after `--` for every request"),
+    llvm::cl::value_desc("socket path"), llvm::cl::cat(DbgCovCategory));
+
+static llvm::cl::opt<bool> Batch(
+    "batch",
+    llvm::cl::desc("Analyse the inputs (or, if there are none, every file in "
+                   "the compilation database) in parallel, writing each one's "
+                   "regions to <input>.dbgcov"),
+    llvm::cl::cat(DbgCovCategory));
+
+static llvm::cl::opt<unsigned> Jobs(
+    "jobs",
+    llvm::cl::desc("Number of worker threads for -batch, or of requests "
+                   "-server handles at once (default: one per hardware "
+                   "thread)"),
+    llvm::cl::init(0), llvm::cl::cat(DbgCovCategory));
+
+static llvm::cl::opt<std::string> PCHDir(
+    "pch-dir",
+    llvm::cl::desc("Inputs are original (not preprocessed) sources: parse each "
+                   "with a precompiled header of its leading #includes, cached "
+                   "in the given directory"),
+    llvm::cl::value_desc("directory"), llvm::cl::cat(DbgCovCategory));
+
+static llvm::cl::opt<std::string> OutputFile(
+    "o",
+    llvm::cl::desc("Write the regions of the (single) input to the given file, "
+                   "replacing it, rather than to stdout"),
+    llvm::cl::value_desc("file"), llvm::cl::cat(DbgCovCategory));
+
+static llvm::cl::opt<std::string> TimeTrace(
+    "time-trace",
+    llvm::cl::desc("Write a Chrome trace (as from Clang's -ftime-trace) of "
+                   "parsing, traversal and output to the given file"),
+    llvm::cl::value_desc("file"), llvm::cl::cat(DbgCovCategory));
+
+static llvm::cl::opt<unsigned> TimeTraceGranularity(
+    "time-trace-granularity",
+    llvm::cl::desc("Minimum duration of events in the -time-trace output, in "
+                   "microseconds"),
+    llvm::cl::init(500), llvm::cl::cat(DbgCovCategory));
+
+
+// Parse one input with `FS` as the file system, writing its regions to `OS`.
+// With `-pch-dir`, the input's prefix comes from a PCH, built if need be;
+// should that fail, the whole input is parsed as if without `-pch-dir`.
+static int RunTool(const CompilationDatabase &Compilations,
+                   IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS,
+                   StringRef inputPath, raw_ostream &OS) {
+  ClangTool Tool(Compilations, {inputPath.str()},
+                 std::make_shared<PCHContainerOperations>(), FS);
+  dbgcov::PrefixPCH prefix;
+  bool found = false;
+  if (!PCHDir.empty()) {
+    if (Error error = dbgcov::PreparePrefixPCH(Compilations, FS, PCHDir,
+                                               inputPath, prefix, found)) {
+      llvm::errs() << "Warning: " << toString(std::move(error)) << "\n";
+      found = false;
     }
-    return true;
   }
-
-  bool VisitIfStmt(IfStmt *s) {
-    if (const auto *cond = s->getCond()) {
-      VISITOR_METHOD_PRINT(IfStmt.Cond, cond)
-    }
-    return true;
+  if (found) {
+    Tool.mapVirtualFile(prefix.HeaderPath, prefix.PrefixText);
+    Tool.mapVirtualFile(prefix.MainFilePath, prefix.MainFileContents);
+    Tool.appendArgumentsAdjuster(getInsertArgumentAdjuster(
+        {"-include-pch", prefix.PCHPath}, ArgumentInsertPosition::BEGIN));
   }
+  auto ActionFactory =
+      CreateDbgCovActionFactory([&OS] { return CreateRegionSink(OS); });
+  return Tool.run(ActionFactory.get());
+}
 
-  bool VisitSwitchStmt(SwitchStmt *s) {
-    if (const auto *cond = s->getCond()) {
-      VISITOR_METHOD_PRINT(SwitchStmt.Cond, cond)
-    }
-    return true;
+static const size_t OutputBufferSize = 1 << 20;
+
+// Analyse one input, writing its regions to `outputPath`. Each call has its
+// own file system view (so its own working directory) and `FileManager`, so
+// calls may run concurrently. A fresh `FileManager` per call is deliberate:
+// builds rewrite the same `.i` paths, and a long-lived `FileManager` would
+// keep serving their stale sizes.
+static int RunDbgCovOnFile(const CompilationDatabase &Compilations,
+                           StringRef workingDirectory, StringRef inputPath,
+                           StringRef outputPath) {
+  IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS(
+      llvm::vfs::createPhysicalFileSystem().release());
+  if (std::error_code error = FS->setCurrentWorkingDirectory(workingDirectory)) {
+    llvm::errs() << "Error: " << workingDirectory << ": " << error.message()
+                 << "\n";
+    return 1;
   }
-
-  bool VisitWhileStmt(WhileStmt *s) {
-    if (const auto *cond = s->getCond()) {
-      VISITOR_METHOD_PRINT(WhileStmt.Cond, cond)
-    }
-    return true;
+  SmallString<128> absoluteOutputPath(outputPath);
+  FS->makeAbsolute(absoluteOutputPath);
+
+  // Write to a temporary file and rename it into place, so that an existing
+  // output is replaced rather than truncated: the driver's result cache may
+  // have hard-linked it.
+  int fd;
+  SmallString<128> tempPath;
+  if (std::error_code error = llvm::sys::fs::createUniqueFile(
+          absoluteOutputPath + ".tmp%%%%%%", fd, tempPath)) {
+    llvm::errs() << "Error: " << absoluteOutputPath << ": " << error.message()
+                 << "\n";
+    return 1;
   }
 
-  // Some nodes require customised handling depending on the data they contain
-
-  bool VisitAsmStmt(AsmStmt *s) {
-    // Adapts the logic of the `BinaryOperator` case below
-    // to work for inline assembly.
-
-    for (const auto *input : s->inputs()) {
-      ReportTreeAsDefined(input, s, "MayBeDefined",
-                          /* beginNextLine = */ false);
-    }
-
-    for (const auto *output : s->outputs()) {
-      ReportTreeAsDefined(output, s, "MustBeDefined",
-                          /* beginNextLine = */ true);
-    }
-
-    return true;
+  int status;
+  {
+    raw_fd_ostream OS(fd, /* shouldClose = */ true);
+    // Regions come a few dozen bytes at a time; write them in large blocks
+    OS.SetBufferSize(OutputBufferSize);
+    status = RunTool(Compilations, FS, inputPath, OS);
   }
-
-  bool VisitBinaryOperator(BinaryOperator *s) {
-    VISITOR_METHOD_PRINT(BinaryOperator, s)
-
-    if (!s->isAssignmentOp())
-      return true;
-
-    // Consider right-hand side variables as likely to be defined
-    // as of the current line
-    ReportTreeAsDefined(s->getRHS(), s, "MayBeDefined",
-                        /* beginNextLine = */ false);
-
-    // Record variable definition region for assignment operations
-    // on the next line _after_ assignment
-    ReportTreeAsDefined(s->getLHS(), s, "MustBeDefined",
-                        /* beginNextLine = */ true);
-
-    return true;
+  if (std::error_code error =
+          llvm::sys::fs::rename(tempPath, absoluteOutputPath)) {
+    llvm::errs() << "Error: " << absoluteOutputPath << ": " << error.message()
+                 << "\n";
+    llvm::sys::fs::remove(tempPath);
+    return 1;
   }
+  return status;
+}
 
-  bool VisitCallExpr(CallExpr *s) {
-    if (const auto *callee = s->getCallee()) {
-      VISITOR_METHOD_PRINT(CallExpr.Callee, callee)
-    }
-
-    // Arguments shouldn't be examined for computation at this level, as they
-    // may have a whole tree of multi-line computation, so we instead inspect
-    // them further by recursion
-    // llvm::errs() << "Call:\n";
-    // s->dump();
-
-    // Mark variables used in call arguments as "may be defined" after it
-    // llvm::errs() << "Arguments: " << s->getNumArgs() << "\n";
-    for (const Expr *argument : s->arguments()) {
-      // llvm::errs() << "Argument:\n";
-      // argument->dump();
-      // Descend to `DeclRefExpr` within the argument
-      while (argument && !isa<DeclRefExpr>(argument)) {
-        // Check whether there are any children
-        if (argument->child_begin() == argument->child_end())
-          break;
-        // Only check the first child for simplicity (seems fine for most cases)
-        const Stmt *child = *argument->child_begin();
-        // llvm::errs() << "Argument child:\n";
-        // child->dump();
-        // Ignore non-`Expr` children
-        if (!isa<Expr>(child))
-          break;
-        argument = cast<Expr>(child);
-      }
-      if (!argument || !isa<DeclRefExpr>(argument))
-        continue;
-      const auto *declRefExpr = cast<DeclRefExpr>(argument);
-      // When referencing existing variables like this, assume storage may
-      // already exist on the current line.
-      ReportDeclRefExprAsDefined(declRefExpr, s, "MayBeDefined",
-                                 /* beginNextLine = */ false);
-    }
+// The number of worker threads for -batch and -server
+static unsigned NumJobs() {
+  return Jobs ? Jobs.getValue()
+              : std::max(1u, std::thread::hardware_concurrency());
+}
 
-    return true;
+// Analyse many inputs on a pool of threads, each input to its own output file.
+// The output for each input is exactly what a separate run would produce.
+static int RunBatch(const CompilationDatabase &Compilations,
+                    const std::vector<std::string> &inputPaths) {
+  SmallString<128> workingDirectory;
+  if (std::error_code error = llvm::sys::fs::current_path(workingDirectory)) {
+    llvm::errs() << "Error: current directory: " << error.message() << "\n";
+    return 1;
   }
 
-  bool TraverseConstantExpr(ConstantExpr *s) {
-    // Skip constant expressions (e.g. case statements)
-    return true;
+  // Start the largest inputs first, so that a big file picked up late doesn't
+  // leave every other worker idle while it finishes. Workers then take the
+  // next queued input whenever they become free.
+  std::vector<std::pair<uint64_t, StringRef>> queue;
+  for (const auto &path : inputPaths) {
+    uint64_t size = 0;
+    llvm::sys::fs::file_size(path, size);
+    queue.emplace_back(size, path);
   }
-
-  bool VisitFunctionDecl(FunctionDecl *s) {
-    // We want to mark the opening and closing braces as having computation
-    // Debug info associates the function prologue / epilogue with these lines
-    if (const auto *body = dyn_cast_if_present<CompoundStmt>(s->getBody())) {
-      // Prologue
-      PrintRegion(llvm::outs(), body->getBeginLoc(), body->getBeginLoc(),
-                  "Computation", "FunctionDecl.Prologue",
-                  /* beginNextLine = */ false);
-
-      // Epilogue
-      PrintRegion(llvm::outs(), body->getEndLoc(), body->getEndLoc(),
-                  "Computation", "FunctionDecl.Epilogue",
-                  /* beginNextLine = */ false);
-
-      for (const auto *param : s->parameters()) {
-        // Record parameter declaration scope
-        // Matches the definition region below, which uses the function body.
-        PrintRegion(llvm::outs(), body->getBeginLoc(), body->getEndLoc(),
-                    "DeclScope", GetExtendedName(*param),
-                    /* beginNextLine = */ false);
-
-        // Record parameter definition region
-        // Debug info typically reflects parameters as defined starting on the
-        // line with the opening brace of the function body.
-        PrintRegion(llvm::outs(), body->getBeginLoc(), body->getEndLoc(),
-                    "MustBeDefined", GetExtendedName(*param),
-                    /* beginNextLine = */ false);
-      }
+  std::stable_sort(queue.begin(), queue.end(),
+                   [](const std::pair<uint64_t, StringRef> &a,
+                      const std::pair<uint64_t, StringRef> &b) {
+                     return a.first > b.first;
+                   });
+
+  std::atomic<size_t> next(0);
+  std::atomic<unsigned> failures(0);
+  auto worker = [&]() {
+    // The profiler is per thread; each one's events are merged on finishing
+    if (!TimeTrace.empty())
+      llvm::timeTraceProfilerInitialize(TimeTraceGranularity, "dbgcov-tool");
+    for (size_t i; (i = next++) < queue.size();) {
+      StringRef inputPath = queue[i].second;
+      if (RunDbgCovOnFile(Compilations, workingDirectory, inputPath,
+                          (inputPath + ".dbgcov").str()))
+        ++failures;
     }
-    return true;
-  }
-
-  bool VisitVarDecl(VarDecl *s) {
-    // Only examine local variables inside functions
-    if (!isa<FunctionDecl>(s->getDeclContext()) || !s->isLocalVarDecl())
-      return true;
-
-    auto &parentMap = TheContext.getParentMapContext();
-    auto *parentDeclStmt = parentMap.getParents(*s)[0].get<DeclStmt>();
-    // `VarDecl` should be child of `DeclStmt`
-    assert(parentDeclStmt && "VarDecl not child of DeclStmt");
-    const auto *parentStmt = GetParentStmt(parentDeclStmt);
-    // Only examine variables within some kind of `Stmt`, such as a continuing
-    // `CompoundStmt` or blocks with associated declarations (e.g. `ForStmt`)
-    if (!parentStmt)
-      return true;
-
-    // Record variable declaration scope
-    // Treats the entire enclosing block as potential scope
-    // This allows for e.g. storage on the stack to match the whole block
-    // Note: We currently filter away stack coverage via the definition filter
-    PrintRegion(llvm::outs(), parentStmt->getBeginLoc(),
-                parentStmt->getEndLoc(), "DeclScope", GetExtendedName(*s),
-                /* beginNextLine = */ false);
-
-    // TODO: Check C++ default initialisation cases
-
-    // `VarDecl` has computation only for automatic locals with an initialiser
-    // Static locals _do not_ have computation (even with an initialiser), as
-    // their "initialisation time" occurs outside the function.
-    if (s->hasInit() && !s->isStaticLocal())
-      VISITOR_METHOD_PRINT(VarDecl, s)
-
-    // Record variable definition region
-    // Debug info typically reflects variables as defined on the line _after_
-    // assignment, so we print the next line here.
-    // Multiple cases are considered as defined:
-    //   - automatic locals with an initialiser
-    //   - static locals (empty initialised when no initialiser present)
-    if (s->hasInit() || s->isStaticLocal())
-      PrintRegion(llvm::outs(), s->getEndLoc(), parentStmt->getEndLoc(),
-                  "MustBeDefined", GetExtendedName(*s),
-                  /* beginNextLine = */ true);
-
-    // Consider initialiser variables as likely to be defined
-    // as of the current line
-    if (s->hasInit())
-      ReportTreeAsDefined(s->getInit(), parentDeclStmt, "MayBeDefined",
-                          /* beginNextLine = */ false);
-
-    return true;
+    if (!TimeTrace.empty())
+      llvm::timeTraceProfilerFinishThread();
+  };
+
+  unsigned numThreads = std::min<size_t>(NumJobs(), queue.size());
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < numThreads; ++i)
+    threads.emplace_back(worker);
+  for (auto &thread : threads)
+    thread.join();
+
+  if (failures) {
+    llvm::errs() << "Error: " << failures << " of " << queue.size()
+                 << " inputs failed\n";
+    return 1;
   }
+  return 0;
+}
 
-private:
-  Rewriter &TheRewriter;
-  ASTContext &TheContext;
-};
-
-// Implementation of the ASTConsumer interface for reading an AST produced
-// by the Clang parser.
-class DbgCovConsumer : public ASTConsumer {
-public:
-  DbgCovConsumer(Rewriter &R, ASTContext &C) : Visitor(R, C), R(R), C(C)
-  {}
-  // Override the method that gets called for each parsed top-level
-  // declaration.
-  bool HandleTopLevelDecl(DeclGroupRef DR) override {
-    //llvm::errs() << "== Saw top-level decl\n";
-    for (DeclGroupRef::iterator b = DR.begin(), e = DR.end(); b != e; ++b) {
-      // HACK: to get parent info, I have to do this, but I have no idea why.
-      C.setTraversalScope({*b});
-      //(*b)->dump();
-
-      // Traverse the declaration using our AST visitor
-      Visitor.TraverseDecl(*b);
-    }
-    return true;
+// Load the compilation database named with CommonOptionsParser's `-p`
+static std::unique_ptr<CompilationDatabase> LoadBuildPathCompilations() {
+  auto *BuildPath = static_cast<llvm::cl::opt<std::string> *>(
+      llvm::cl::getRegisteredOptions().lookup("p"));
+  if (!BuildPath || BuildPath->empty()) {
+    llvm::errs() << "Error: no input files (pass them, or a compilation "
+                    "database with -p, or compiler options after `--`)\n";
+    return nullptr;
   }
+  std::string error;
+  auto Compilations =
+      CompilationDatabase::autoDetectFromDirectory(*BuildPath, error);
+  if (!Compilations)
+    llvm::errs() << "Error: " << error << "\n";
+  return Compilations;
+}
 
-private:
-  DbgCovASTVisitor Visitor;
-  Rewriter &R;
-  ASTContext &C;
-};
-
-// For each source file provided to the tool, a new FrontendAction is created.
-class MyFrontendAction : public ASTFrontendAction {
-public:
-  MyFrontendAction() {}
-  std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
-                                                 StringRef file) override {
-    //llvm::errs() << "== Creating AST consumer for: " << file << "\n";
-    TheRewriter.setSourceMgr(CI.getSourceManager(), CI.getLangOpts());
-    return make_unique<DbgCovConsumer>(TheRewriter, CI.getASTContext());
+// Write out the `-time-trace` profile, if any, once all work is done
+static int FinishTimeTrace(int status) {
+  if (!llvm::timeTraceProfilerEnabled())
+    return status;
+  if (Error error = llvm::timeTraceProfilerWrite(TimeTrace, "dbgcov-tool")) {
+    llvm::errs() << "Error: " << toString(std::move(error)) << "\n";
+    status = 1;
   }
-
-private:
-  Rewriter TheRewriter;
-};
-
-/* Clang wants a "compilations database" and a "source path list".
- * We want to mimic the gcc command-line interface; since so (mostly)
- * does clang, we should be able to get what we want from libclang
- * code. How does it parse its argc and argv? Where is the clang
- * main(), even? It's in clang/tools/driver.
- * HACK: for now, don't mimic gcc's command line. Just use the
- * LLVM common options format, and let our wrapper script adapt.
- * (But see Attic/options.cpp for a partial attempt at the original.)
- */
-static llvm::cl::OptionCategory DbgCovCategory("DbgCov");
+  llvm::timeTraceProfilerCleanup();
+  return status;
+}
 
 int main(int argc, const char **argv) {
   /* How do we use an ordinary (gcc-like) compiler command line
@@ -530,8 +275,14 @@ int main(int argc, const char **argv) {
   // build a CompilationsDatabase from argv
   /* Some time between LLVM 8 and LLVM 13 the constructor we were using
    * has become protected and it wants us to call ::create() instead. */
+  // Compiler options after `--` give a compilation database for any input
+  bool HaveCompilerOptions =
+      std::any_of(argv, argv + argc,
+                  [](const char *arg) { return StringRef(arg) == "--"; });
 #ifdef HAVE_COMMONOPTIONSPARSER_CREATE
-  auto ExpectedParser = CommonOptionsParser::create(argc, argv, DbgCovCategory);
+  // Source paths are optional only when running as a server
+  auto ExpectedParser = CommonOptionsParser::create(argc, argv, DbgCovCategory,
+                                                    llvm::cl::ZeroOrMore);
   if (!ExpectedParser) {
     // Fail gracefully for unsupported options.
     llvm::errs() << ExpectedParser.takeError();
@@ -539,19 +290,98 @@ int main(int argc, const char **argv) {
   }
   CommonOptionsParser &OptionsParser = ExpectedParser.get();
 #else
-  CommonOptionsParser OptionsParser(argc, argv, DbgCovCategory);
+  CommonOptionsParser OptionsParser(argc, argv, DbgCovCategory,
+                                    llvm::cl::ZeroOrMore);
 #endif
   //llvm::errs() << "source paths size is " << OptionsParser.getSourcePathList().size() << "\n";
-  auto &Compilations = OptionsParser.getCompilations();
   auto &SourcePaths = OptionsParser.getSourcePathList();
+  // Without sources, the parser leaves even a `-p` database unloaded
+  std::unique_ptr<CompilationDatabase> BuildPathCompilations;
+  if (SourcePaths.empty() && !HaveCompilerOptions) {
+    BuildPathCompilations = LoadBuildPathCompilations();
+    if (!BuildPathCompilations)
+      return 1;
+  }
+  const CompilationDatabase &Compilations =
+      BuildPathCompilations ? *BuildPathCompilations
+                            : OptionsParser.getCompilations();
+
+  if (Error error = PrepareAnalysis()) {
+    llvm::errs() << "Error: " << toString(std::move(error)) << "\n";
+    return 1;
+  }
+
+  if (!TimeTrace.empty()) {
+    // A server never finishes, so would never write its trace
+    if (!ServerSocket.empty()) {
+      llvm::errs() << "Error: -time-trace cannot be used with -server\n";
+      return 1;
+    }
+    llvm::timeTraceProfilerInitialize(TimeTraceGranularity, "dbgcov-tool");
+  }
+
+  // Server and batch requests each name their own output
+  if (!OutputFile.empty() &&
+      (!ServerSocket.empty() || Batch || SourcePaths.size() != 1)) {
+    llvm::errs() << "Error: -o needs exactly one input\n";
+    return 1;
+  }
+
+  // In server mode, process startup and option parsing happen once, and the
+  // driver sends us each preprocessed file in turn
+  if (!ServerSocket.empty()) {
+    return dbgcov::RunServer(
+        ServerSocket, NumJobs(),
+        [&Compilations](const dbgcov::ServerRequest &request) {
+          return RunDbgCovOnFile(Compilations, request.WorkingDirectory,
+                                 request.InputPath, request.OutputPath);
+        });
+  }
+  // The cache describes a single translation unit
+  if (!IncrementalCache.empty() &&
+      (!ServerSocket.empty() || Batch || SourcePaths.size() != 1)) {
+    llvm::errs() << "Error: -incremental-cache needs exactly one input\n";
+    return 1;
+  }
+  if (Batch) {
+    return FinishTimeTrace(RunBatch(Compilations,
+                                    SourcePaths.empty()
+                                        ? Compilations.getAllFiles()
+                                        : SourcePaths));
+  }
+  if (SourcePaths.empty()) {
+    llvm::errs() << "Error: no input files\n";
+    return 1;
+  }
+  if (!OutputFile.empty()) {
+    SmallString<128> workingDirectory;
+    if (std::error_code error =
+            llvm::sys::fs::current_path(workingDirectory)) {
+      llvm::errs() << "Error: " << error.message() << "\n";
+      return 1;
+    }
+    return FinishTimeTrace(RunDbgCovOnFile(Compilations, workingDirectory,
+                                           SourcePaths.front(), OutputFile));
+  }
+
+  // Each source has its own prefix, so needs its own tool
+  if (!PCHDir.empty()) {
+    int status = 0;
+    for (const auto &path : SourcePaths) {
+      IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS(
+          llvm::vfs::createPhysicalFileSystem().release());
+      if (RunTool(Compilations, FS, path, llvm::outs()))
+        status = 1;
+    }
+    return FinishTimeTrace(status);
+  }
+
   ClangTool Tool(Compilations, SourcePaths);
 
   // ClangTool::run accepts a FrontendActionFactory, which is then used to
-  // create new objects implementing the FrontendAction interface. Here we use
-  // the helper newFrontendActionFactory to create a default factory that will
-  // return a new MyFrontendAction object every time.
-  // To further customize this, we could create our own factory class.
-  std::unique_ptr<FrontendActionFactory> ActionFactory
-   = newFrontendActionFactory<MyFrontendAction>();
-  return Tool.run(ActionFactory.get());
+  // create new objects implementing the FrontendAction interface. Ours
+  // creates actions writing to stdout every time.
+  auto ActionFactory = CreateDbgCovActionFactory(
+      [] { return CreateRegionSink(llvm::outs()); });
+  return FinishTimeTrace(Tool.run(ActionFactory.get()));
 }
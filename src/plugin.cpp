@@ -0,0 +1,143 @@
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#ifdef USE_STD_UNIQUE_PTR
+#include <memory>
+#endif
+
+#include "clang/AST/ASTConsumer.h"
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Frontend/FrontendPluginRegistry.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "analysis.h"
+#include "libdbgcov.h"
+
+/* `dbgcov-plugin.so`: the analysis as a Clang plugin, for builds that compile
+ * with Clang. Rather than parse each translation unit again (from a saved
+ * `.i`) in `dbgcov-tool`, the plugin takes its regions from the compiler's
+ * own AST:
+ *
+ *   clang -fplugin=dbgcov-plugin.so -c foo.c -o foo.o
+ *
+ * writes `foo.o.dbgcov` beside `foo.o`. The plugin's arguments are the
+ * analysis options of `dbgcov-tool`, without their leading `-`, e.g.
+ * `-fplugin-arg-dbgcov-definedness=cfg`, and `output=<file>` to write the
+ * regions somewhere else.
+ */
+
+using namespace clang;
+using namespace llvm;
+using dbgcov::RegionSink;
+#ifdef USE_STD_UNIQUE_PTR
+using std::make_unique;
+#else
+using llvm::make_unique;
+#endif
+
+namespace {
+
+// Writes regions to a temporary file, renamed into place once they are all
+// written, so that (as with `dbgcov-tool`) an existing output is replaced
+// rather than written through. The plugin action is gone by the time the
+// regions are, so the file belongs to the sink.
+class OutputFileRegionSink : public RegionSink {
+public:
+  OutputFileRegionSink(int fd, std::string tempPath, std::string path)
+      : OS(fd, /* shouldClose = */ true), Next(CreateRegionSink(OS)),
+        TempPath(std::move(tempPath)), Path(std::move(path)) {}
+  ~OutputFileRegionSink() override {
+    if (!Finished)
+      llvm::sys::fs::remove(TempPath);
+  }
+
+  void AddRegion(const dbgcov::Region &region) override {
+    Next->AddRegion(region);
+  }
+  void BeginFunction(StringRef name, StringRef path, unsigned line) override {
+    Next->BeginFunction(name, path, line);
+  }
+  void Finish() override {
+    Next->Finish();
+    OS.close();
+    Finished = true;
+    if (std::error_code error = llvm::sys::fs::rename(TempPath, Path)) {
+      llvm::errs() << "Error: " << Path << ": " << error.message() << "\n";
+      llvm::sys::fs::remove(TempPath);
+    }
+  }
+
+private:
+  raw_fd_ostream OS;
+  std::unique_ptr<RegionSink> Next;
+  std::string TempPath;
+  std::string Path;
+  bool Finished = false;
+};
+
+class DbgCovPluginAction : public PluginASTAction {
+protected:
+  std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+                                                 StringRef file) override {
+    std::string path = OutputPath;
+    if (path.empty()) {
+      StringRef objectPath = CI.getFrontendOpts().OutputFile;
+      if (objectPath.empty() || objectPath == "-")
+        objectPath = file;
+      path = (objectPath + ".dbgcov").str();
+    }
+    int fd;
+    SmallString<128> tempPath;
+    if (std::error_code error = llvm::sys::fs::createUniqueFile(
+            path + ".tmp%%%%%%", fd, tempPath)) {
+      ReportError(CI, path + ": " + error.message());
+      return make_unique<ASTConsumer>();
+    }
+    return CreateDbgCovConsumer(
+        CI,
+        make_unique<OutputFileRegionSink>(fd, tempPath.str().str(), path),
+        file);
+  }
+
+  // Each argument is `<option>=<value>` (or just `<option>` for a flag)
+  bool ParseArgs(const CompilerInstance &CI,
+                 const std::vector<std::string> &args) override {
+    std::vector<std::string> options;
+    for (const auto &arg : args) {
+      StringRef name, value;
+      std::tie(name, value) = StringRef(arg).split('=');
+      if (name == "output")
+        OutputPath = value.str();
+      else
+        options.push_back(arg);
+    }
+    if (Error error = dbgcov::SetAnalysisOptions(options)) {
+      ReportError(CI, toString(std::move(error)));
+      return false;
+    }
+    return true;
+  }
+
+  // Runs alongside the compile, not instead of it
+  ActionType getActionType() override { return AddBeforeMainAction; }
+
+private:
+  static void ReportError(const CompilerInstance &CI, const Twine &message) {
+    DiagnosticsEngine &diagnostics = CI.getDiagnostics();
+    unsigned id =
+        diagnostics.getCustomDiagID(DiagnosticsEngine::Error, "dbgcov: %0");
+    diagnostics.Report(id) << message.str();
+  }
+
+  std::string OutputPath;
+};
+
+} // namespace
+
+static FrontendPluginRegistry::Add<DbgCovPluginAction>
+    Registration("dbgcov", "Write debug info coverage regions");
@@ -0,0 +1,256 @@
+#include "prefix-pch.h"
+
+#include <memory>
+#include <vector>
+
+#include "clang/Basic/LangOptions.h"
+#include "clang/Basic/Version.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Frontend/Utils.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+using namespace clang::tooling;
+using namespace llvm;
+
+namespace dbgcov {
+
+static const char DependenciesHeader[] = "dbgcov-pch-deps 1";
+
+namespace {
+
+// Records every file the PCH was built from, system headers included
+class PrefixDependencyCollector : public DependencyCollector {
+public:
+  bool needSystemDependencies() override { return true; }
+};
+
+class BuildPrefixPCHAction : public GeneratePCHAction {
+public:
+  BuildPrefixPCHAction(StringRef outputPath,
+                       std::shared_ptr<DependencyCollector> dependencies)
+      : OutputPath(outputPath.str()), Dependencies(std::move(dependencies)) {}
+
+protected:
+  // Before the preprocessor exists, which is when the collector is attached
+  bool BeginInvocation(CompilerInstance &CI) override {
+    CI.getFrontendOpts().OutputFile = OutputPath;
+    CI.addDependencyCollector(Dependencies);
+    return GeneratePCHAction::BeginInvocation(CI);
+  }
+
+private:
+  std::string OutputPath;
+  std::shared_ptr<DependencyCollector> Dependencies;
+};
+
+class BuildPrefixPCHActionFactory : public FrontendActionFactory {
+public:
+  BuildPrefixPCHActionFactory(StringRef outputPath,
+                              std::shared_ptr<DependencyCollector> dependencies)
+      : OutputPath(outputPath), Dependencies(std::move(dependencies)) {}
+  std::unique_ptr<FrontendAction> create() override {
+    return std::unique_ptr<FrontendAction>(
+        new BuildPrefixPCHAction(OutputPath, Dependencies));
+  }
+
+private:
+  StringRef OutputPath;
+  std::shared_ptr<DependencyCollector> Dependencies;
+};
+
+} // namespace
+
+static Error PCHError(const Twine &message) {
+  return createStringError(inconvertibleErrorCode(), "%s",
+                           message.str().c_str());
+}
+
+static uint64_t GetModificationTime(const vfs::Status &status) {
+  return status.getLastModificationTime().time_since_epoch().count();
+}
+
+/* The dependencies file lists each file the PCH was built from, as
+ *
+ *   dbgcov-pch-deps 1
+ *   <size> <modification time> <absolute path>
+ *   ...
+ *
+ * with tab-separated fields. The PCH is only used while they all match.
+ */
+static bool IsUpToDate(vfs::FileSystem &FS, StringRef pchPath,
+                       StringRef dependenciesPath) {
+  if (!FS.status(pchPath))
+    return false;
+  auto buffer = FS.getBufferForFile(dependenciesPath);
+  if (!buffer)
+    return false;
+  SmallVector<StringRef, 64> lines;
+  (*buffer)->getBuffer().split(lines, '\n', -1, /* KeepEmpty = */ false);
+  if (lines.empty() || lines.front() != DependenciesHeader)
+    return false;
+  for (size_t i = 1; i < lines.size(); ++i) {
+    SmallVector<StringRef, 3> fields;
+    lines[i].split(fields, '\t', 2);
+    uint64_t size, modificationTime;
+    if (fields.size() != 3 || fields[0].getAsInteger(10, size) ||
+        fields[1].getAsInteger(10, modificationTime))
+      return false;
+    auto status = FS.status(fields[2]);
+    if (!status || status->getSize() != size ||
+        GetModificationTime(*status) != modificationTime)
+      return false;
+  }
+  return true;
+}
+
+static Error WriteDependencies(vfs::FileSystem &FS, StringRef path,
+                               StringRef headerPath, StringRef directory,
+                               ArrayRef<std::string> dependencies) {
+  std::string contents;
+  raw_string_ostream stream(contents);
+  stream << DependenciesHeader << "\n";
+  for (const auto &dependency : dependencies) {
+    SmallString<128> dependencyPath(dependency);
+    if (llvm::sys::path::is_relative(dependencyPath))
+      llvm::sys::fs::make_absolute(directory, dependencyPath);
+    // The prefix header itself is never on disk
+    if (dependencyPath == headerPath)
+      continue;
+    auto status = FS.status(dependencyPath);
+    if (!status)
+      return PCHError(Twine(dependencyPath) + ": " +
+                      status.getError().message());
+    stream << status->getSize() << "\t" << GetModificationTime(*status) << "\t"
+           << dependencyPath << "\n";
+  }
+
+  int fd;
+  SmallString<128> tempPath;
+  if (std::error_code error =
+          llvm::sys::fs::createUniqueFile(path + ".tmp%%%%%%", fd, tempPath))
+    return PCHError(path + ": " + error.message());
+  {
+    raw_fd_ostream OS(fd, /* shouldClose = */ true);
+    OS << stream.str();
+  }
+  if (std::error_code error = llvm::sys::fs::rename(tempPath, path)) {
+    llvm::sys::fs::remove(tempPath);
+    return PCHError(path + ": " + error.message());
+  }
+  return Error::success();
+}
+
+Error PreparePrefixPCH(const CompilationDatabase &compilations,
+                       IntrusiveRefCntPtr<vfs::FileSystem> FS,
+                       StringRef cacheDir, StringRef inputPath,
+                       PrefixPCH &prefix, bool &found) {
+  found = false;
+  SmallString<128> mainFilePath(inputPath);
+  FS->makeAbsolute(mainFilePath);
+  auto buffer = FS->getBufferForFile(mainFilePath);
+  if (!buffer)
+    return PCHError(Twine(mainFilePath) + ": " + buffer.getError().message());
+  StringRef source = (*buffer)->getBuffer();
+
+  // Only the directives' extent matters, so any C dialect will do
+  LangOptions langOpts;
+  langOpts.C99 = true;
+  langOpts.LineComment = true;
+  PreambleBounds bounds = Lexer::ComputePreamble(source, langOpts);
+  if (bounds.Size == 0)
+    return Error::success();
+  prefix.PrefixText = source.take_front(bounds.Size).str();
+  if (!bounds.PreambleEndsAtStartOfLine)
+    prefix.PrefixText += "\n";
+
+  std::vector<CompileCommand> commands =
+      compilations.getCompileCommands(mainFilePath);
+  if (commands.empty())
+    return PCHError(mainFilePath + ": no compile command");
+  const CompileCommand &command = commands.front();
+  // The options, without the tool name, the source or anything that varies
+  // between the sources of one build but doesn't affect parsing
+  std::vector<std::string> args;
+  for (size_t i = 1; i < command.CommandLine.size(); ++i) {
+    const std::string &arg = command.CommandLine[i];
+    if (arg == "-o" || arg == "-MF" || arg == "-MT" || arg == "-MQ") {
+      ++i;
+      continue;
+    }
+    if (arg == "-c" || arg == command.Filename || arg == mainFilePath)
+      continue;
+    args.push_back(arg);
+  }
+  StringRef mainDirectory = llvm::sys::path::parent_path(mainFilePath);
+
+  MD5 hash;
+  auto update = [&hash](StringRef str) {
+    hash.update(str);
+    hash.update(StringRef("", 1));
+  };
+  update(getClangFullVersion());
+  update(command.Directory);
+  update(mainDirectory);
+  for (const auto &arg : args)
+    update(arg);
+  update(prefix.PrefixText);
+  MD5::MD5Result result;
+  hash.final(result);
+  SmallString<32> key = result.digest();
+
+  SmallString<128> directory(cacheDir);
+  FS->makeAbsolute(directory);
+  SmallString<128> path(directory);
+  llvm::sys::path::append(path, Twine(key) + ".h");
+  prefix.HeaderPath = path.str().str();
+  path = directory;
+  llvm::sys::path::append(path, Twine(key) + ".pch");
+  prefix.PCHPath = path.str().str();
+  path = directory;
+  llvm::sys::path::append(path, Twine(key) + ".deps");
+  std::string dependenciesPath = path.str().str();
+
+  // The source as parsed after the PCH: the prefix blanked out, keeping its
+  // line breaks so that line and column numbers don't change
+  prefix.MainFilePath = mainFilePath.str().str();
+  prefix.MainFileContents = source.str();
+  for (size_t i = 0; i < bounds.Size; ++i) {
+    char &c = prefix.MainFileContents[i];
+    if (c != '\n' && c != '\r')
+      c = ' ';
+  }
+  found = true;
+
+  if (IsUpToDate(*FS, prefix.PCHPath, dependenciesPath))
+    return Error::success();
+
+  if (std::error_code error = llvm::sys::fs::create_directories(directory))
+    return PCHError(Twine(directory) + ": " + error.message());
+  // The prefix's own `#include "..."`s are relative to the source's directory,
+  // not the header's
+  args.push_back("-iquote");
+  args.push_back(mainDirectory.str());
+  FixedCompilationDatabase headerCompilations(command.Directory, args);
+  ClangTool tool(headerCompilations, {prefix.HeaderPath},
+                 std::make_shared<PCHContainerOperations>(), FS);
+  tool.mapVirtualFile(prefix.HeaderPath, prefix.PrefixText);
+  auto dependencies = std::make_shared<PrefixDependencyCollector>();
+  BuildPrefixPCHActionFactory factory(prefix.PCHPath, dependencies);
+  if (tool.run(&factory))
+    return PCHError("could not precompile the prefix of " +
+                    Twine(mainFilePath));
+  return WriteDependencies(*FS, dependenciesPath, prefix.HeaderPath,
+                           command.Directory, dependencies->getDependencies());
+}
+
+} // namespace dbgcov
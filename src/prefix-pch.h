@@ -0,0 +1,52 @@
+#ifndef DBGCOV_PREFIX_PCH_H
+#define DBGCOV_PREFIX_PCH_H
+
+#include <string>
+
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+namespace dbgcov {
+
+/* For `-pch-dir`: how to parse an original (not preprocessed) source file
+ * using a precompiled header of its prefix, i.e. the run of preprocessor
+ * directives and comments it starts with (usually its `#include`s).
+ *
+ * The PCH is built from a header holding exactly the prefix's text, and the
+ * source is then parsed with the prefix blanked out (every character but line
+ * breaks replaced by a space), so everything after it keeps its line and
+ * column. Neither the header nor the blanked source exists on disk: both are
+ * mapped into the tool's file system, under the paths given here.
+ */
+struct PrefixPCH {
+  // Where the prefix header would be; map it (to `PrefixText`) whenever the
+  // PCH is used, as Clang checks it is unchanged
+  std::string HeaderPath;
+  std::string PrefixText;
+  std::string PCHPath;
+  // The absolute path of the source, and what to map there
+  std::string MainFilePath;
+  std::string MainFileContents;
+};
+
+/* Find, or build, the PCH for the prefix of `inputPath` in `cacheDir`.
+ *
+ * PCHs are shared by any sources with the same prefix, compiler options,
+ * directory and working directory (relative `#include "..."`s resolve against
+ * the source's directory), and are rebuilt whenever a header they include
+ * changes. Concurrent runs may build the same PCH; the last one wins.
+ *
+ * Returns false in `found`, without building anything, if the source has no
+ * prefix to precompile.
+ */
+llvm::Error
+PreparePrefixPCH(const clang::tooling::CompilationDatabase &compilations,
+                 llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS,
+                 llvm::StringRef cacheDir, llvm::StringRef inputPath,
+                 PrefixPCH &prefix, bool &found);
+
+} // namespace dbgcov
+
+#endif
@@ -0,0 +1,390 @@
+#include "region-index.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <tuple>
+
+#include "llvm/ADT/SmallVector.h"
+
+using namespace llvm;
+using llvm::support::ulittle32_t;
+using llvm::support::ulittle64_t;
+
+namespace dbgcov {
+
+// On-disk structures; see the layout in the header. Their members are all
+// unaligned little-endian integers, so they can be read straight from the
+// mapping and written straight out.
+
+struct IndexHeader {
+  char Magic[sizeof(IndexMagic)];
+  ulittle32_t Version;
+  ulittle32_t NumStrings;
+  ulittle32_t NumFiles;
+  ulittle32_t NumRegions;
+  ulittle32_t NumVariables;
+  ulittle32_t NumReferences;
+  ulittle64_t StringsOffset;
+  ulittle64_t StringDataOffset;
+  ulittle64_t FilesOffset;
+  ulittle64_t RegionsOffset;
+  ulittle64_t VariablesOffset;
+  ulittle64_t ReferencesOffset;
+};
+
+struct IndexFileEntry {
+  ulittle32_t Path;
+  ulittle32_t FirstRegion;
+  ulittle32_t NumRegions;
+};
+
+struct IndexRegionEntry {
+  ulittle32_t BeginLine;
+  ulittle32_t BeginColumn;
+  ulittle32_t EndLine;
+  ulittle32_t EndColumn;
+  ulittle32_t Detail;
+  ulittle32_t MaxEndLine;
+  ulittle32_t Kind;
+};
+
+struct IndexVariableEntry {
+  ulittle32_t Name;
+  ulittle32_t FirstReference;
+  ulittle32_t NumReferences;
+};
+
+static Error IndexError(const char *message) {
+  return createStringError(inconvertibleErrorCode(), "%s", message);
+}
+
+template <typename T> static void WriteEntry(raw_ostream &OS, const T &entry) {
+  OS.write(reinterpret_cast<const char *>(&entry), sizeof(entry));
+}
+
+static void WriteUInt32(raw_ostream &OS, uint32_t value) {
+  ulittle32_t entry;
+  entry = value;
+  WriteEntry(OS, entry);
+}
+
+static uint64_t AlignTo4(uint64_t offset) { return (offset + 3) & ~uint64_t(3); }
+
+uint32_t RegionIndexBuilder::GetStringId(StringRef str) {
+  auto inserted = StringIds.insert(std::make_pair(str, Strings.size()));
+  if (inserted.second)
+    Strings.push_back(inserted.first->getKey());
+  return inserted.first->getValue();
+}
+
+void RegionIndexBuilder::AddRegion(const Region &region) {
+  PendingRegion pending;
+  pending.Path = GetStringId(region.Path);
+  pending.BeginLine = region.BeginLine;
+  pending.BeginColumn = region.BeginColumn;
+  pending.EndLine = region.EndLine;
+  pending.EndColumn = region.EndColumn;
+  pending.Detail = GetStringId(region.Detail);
+  pending.Kind = region.Kind;
+  Regions.push_back(pending);
+}
+
+Error RegionIndexBuilder::Write(raw_ostream &OS) const {
+  // Number the strings in sorted order
+  std::vector<uint32_t> sortedIds(Strings.size());
+  std::iota(sortedIds.begin(), sortedIds.end(), 0);
+  std::sort(sortedIds.begin(), sortedIds.end(), [&](uint32_t a, uint32_t b) {
+    return Strings[a] < Strings[b];
+  });
+  std::vector<uint32_t> rank(Strings.size());
+  uint64_t stringDataSize = 0;
+  for (uint32_t i = 0; i < sortedIds.size(); ++i) {
+    rank[sortedIds[i]] = i;
+    stringDataSize += Strings[sortedIds[i]].size();
+  }
+  if (stringDataSize > UINT32_MAX)
+    return IndexError("too much string data for the index format");
+
+  std::vector<PendingRegion> regions(Regions);
+  for (auto &region : regions) {
+    region.Path = rank[region.Path];
+    region.Detail = rank[region.Detail];
+  }
+  auto key = [](const PendingRegion &r) {
+    return std::make_tuple(r.Path, r.BeginLine, r.BeginColumn, r.EndLine,
+                           r.EndColumn, static_cast<unsigned>(r.Kind),
+                           r.Detail);
+  };
+  std::sort(regions.begin(), regions.end(),
+            [&](const PendingRegion &a, const PendingRegion &b) {
+              return key(a) < key(b);
+            });
+  regions.erase(std::unique(regions.begin(), regions.end(),
+                            [&](const PendingRegion &a,
+                                const PendingRegion &b) {
+                              return key(a) == key(b);
+                            }),
+                regions.end());
+
+  // Group the regions by file, and references to them by variable
+  std::vector<IndexFileEntry> files;
+  std::vector<IndexRegionEntry> regionEntries(regions.size());
+  std::vector<std::pair<uint32_t, uint32_t>> references;
+  uint32_t maxEndLine = 0;
+  for (uint32_t i = 0; i < regions.size(); ++i) {
+    const PendingRegion &region = regions[i];
+    if (files.empty() || files.back().Path != region.Path) {
+      IndexFileEntry file;
+      file.Path = region.Path;
+      file.FirstRegion = i;
+      file.NumRegions = 0;
+      files.push_back(file);
+      maxEndLine = 0;
+    }
+    files.back().NumRegions = files.back().NumRegions + 1;
+    maxEndLine = std::max(maxEndLine, region.EndLine);
+
+    IndexRegionEntry &entry = regionEntries[i];
+    entry.BeginLine = region.BeginLine;
+    entry.BeginColumn = region.BeginColumn;
+    entry.EndLine = region.EndLine;
+    entry.EndColumn = region.EndColumn;
+    entry.Detail = region.Detail;
+    entry.MaxEndLine = maxEndLine;
+    entry.Kind = static_cast<uint32_t>(region.Kind);
+    if (region.Kind != RegionKind::Computation)
+      references.emplace_back(region.Detail, i);
+  }
+  std::sort(references.begin(), references.end());
+  std::vector<IndexVariableEntry> variables;
+  for (uint32_t i = 0; i < references.size(); ++i) {
+    if (variables.empty() || variables.back().Name != references[i].first) {
+      IndexVariableEntry variable;
+      variable.Name = references[i].first;
+      variable.FirstReference = i;
+      variable.NumReferences = 0;
+      variables.push_back(variable);
+    }
+    variables.back().NumReferences = variables.back().NumReferences + 1;
+  }
+
+  IndexHeader header;
+  memcpy(header.Magic, IndexMagic, sizeof(IndexMagic));
+  header.Version = IndexVersion;
+  header.NumStrings = Strings.size();
+  header.NumFiles = files.size();
+  header.NumRegions = regionEntries.size();
+  header.NumVariables = variables.size();
+  header.NumReferences = references.size();
+  uint64_t offset = sizeof(IndexHeader);
+  header.StringsOffset = offset;
+  offset += (uint64_t(Strings.size()) + 1) * sizeof(ulittle32_t);
+  header.StringDataOffset = offset;
+  offset = AlignTo4(offset + stringDataSize);
+  header.FilesOffset = offset;
+  offset += files.size() * sizeof(IndexFileEntry);
+  header.RegionsOffset = offset;
+  offset += regionEntries.size() * sizeof(IndexRegionEntry);
+  header.VariablesOffset = offset;
+  offset += variables.size() * sizeof(IndexVariableEntry);
+  header.ReferencesOffset = offset;
+
+  WriteEntry(OS, header);
+  uint32_t stringOffset = 0;
+  for (uint32_t id : sortedIds) {
+    WriteUInt32(OS, stringOffset);
+    stringOffset += Strings[id].size();
+  }
+  WriteUInt32(OS, stringOffset);
+  for (uint32_t id : sortedIds)
+    OS << Strings[id];
+  OS.write_zeros(AlignTo4(stringDataSize) - stringDataSize);
+  for (const auto &file : files)
+    WriteEntry(OS, file);
+  for (const auto &entry : regionEntries)
+    WriteEntry(OS, entry);
+  for (const auto &variable : variables)
+    WriteEntry(OS, variable);
+  for (const auto &reference : references)
+    WriteUInt32(OS, reference.second);
+  return Error::success();
+}
+
+Expected<std::unique_ptr<RegionIndex>> RegionIndex::Open(StringRef path) {
+  // Large files are mapped rather than read
+  auto buffer = MemoryBuffer::getFile(path, /* IsText = */ false,
+                                      /* RequiresNullTerminator = */ false);
+  if (!buffer)
+    return createStringError(buffer.getError(), "%s: %s", path.str().c_str(),
+                             buffer.getError().message().c_str());
+  return Create(std::move(*buffer));
+}
+
+Expected<std::unique_ptr<RegionIndex>>
+RegionIndex::Create(std::unique_ptr<MemoryBuffer> buffer) {
+  std::unique_ptr<RegionIndex> index(new RegionIndex(std::move(buffer)));
+  if (Error error = index->Initialise())
+    return error;
+  return index;
+}
+
+// Check that the tables lie within the file; their contents are checked as
+// they are used, so that opening an index doesn't touch all of it
+Error RegionIndex::Initialise() {
+  StringRef data = Buffer->getBuffer();
+  if (data.size() < sizeof(IndexHeader) ||
+      memcmp(data.data(), IndexMagic, sizeof(IndexMagic)))
+    return IndexError("not a dbgcov index file");
+  Header = reinterpret_cast<const IndexHeader *>(data.data());
+  if (Header->Version != IndexVersion)
+    return IndexError("unsupported index version");
+
+  auto table = [&](uint64_t offset, uint64_t count, uint64_t size,
+                   const void *&table) {
+    if (offset > data.size() || count > (data.size() - offset) / size)
+      return false;
+    table = data.data() + offset;
+    return true;
+  };
+  const void *stringOffsets, *files, *regions, *variables, *references;
+  if (!table(Header->StringsOffset, uint64_t(Header->NumStrings) + 1,
+             sizeof(ulittle32_t), stringOffsets) ||
+      !table(Header->FilesOffset, Header->NumFiles, sizeof(IndexFileEntry),
+             files) ||
+      !table(Header->RegionsOffset, Header->NumRegions,
+             sizeof(IndexRegionEntry), regions) ||
+      !table(Header->VariablesOffset, Header->NumVariables,
+             sizeof(IndexVariableEntry), variables) ||
+      !table(Header->ReferencesOffset, Header->NumReferences,
+             sizeof(ulittle32_t), references) ||
+      Header->StringDataOffset > data.size())
+    return IndexError("truncated index file");
+  StringOffsets = static_cast<const ulittle32_t *>(stringOffsets);
+  StringData = data.data() + Header->StringDataOffset;
+  StringDataSize = data.size() - Header->StringDataOffset;
+  Files = static_cast<const IndexFileEntry *>(files);
+  Regions = static_cast<const IndexRegionEntry *>(regions);
+  Variables = static_cast<const IndexVariableEntry *>(variables);
+  References = static_cast<const ulittle32_t *>(references);
+  return Error::success();
+}
+
+uint32_t RegionIndex::GetNumFiles() const { return Header->NumFiles; }
+uint32_t RegionIndex::GetNumRegions() const { return Header->NumRegions; }
+uint32_t RegionIndex::GetNumVariables() const { return Header->NumVariables; }
+
+StringRef RegionIndex::GetString(uint32_t index) const {
+  if (index >= Header->NumStrings)
+    return StringRef();
+  uint32_t begin = StringOffsets[index];
+  uint32_t end = StringOffsets[index + 1];
+  if (begin > end || end > StringDataSize)
+    return StringRef();
+  return StringRef(StringData + begin, end - begin);
+}
+
+bool RegionIndex::FindString(StringRef str, uint32_t &index) const {
+  uint32_t low = 0, high = Header->NumStrings;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    if (GetString(middle) < str)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  index = low;
+  return low < Header->NumStrings && GetString(low) == str;
+}
+
+Region RegionIndex::GetRegion(uint32_t fileIndex, uint32_t regionIndex) const {
+  const IndexRegionEntry &entry = Regions[regionIndex];
+  Region region;
+  region.Path = GetString(Files[fileIndex].Path);
+  region.BeginLine = entry.BeginLine;
+  region.BeginColumn = entry.BeginColumn;
+  region.EndLine = entry.EndLine;
+  region.EndColumn = entry.EndColumn;
+  region.Kind = entry.Kind < NumRegionKinds
+                    ? static_cast<RegionKind>(uint32_t(entry.Kind))
+                    : RegionKind::Computation;
+  region.Detail = GetString(entry.Detail);
+  return region;
+}
+
+void RegionIndex::FindRegions(
+    StringRef path, unsigned firstLine, unsigned lastLine,
+    function_ref<void(const Region &)> callback) const {
+  uint32_t pathIndex;
+  if (!FindString(path, pathIndex))
+    return;
+  const IndexFileEntry *filesEnd = Files + Header->NumFiles;
+  const IndexFileEntry *file = std::lower_bound(
+      Files, filesEnd, pathIndex,
+      [](const IndexFileEntry &entry, uint32_t path) {
+        return entry.Path < path;
+      });
+  if (file == filesEnd || file->Path != pathIndex)
+    return;
+  uint32_t first = file->FirstRegion;
+  uint32_t count = file->NumRegions;
+  if (first > Header->NumRegions || count > Header->NumRegions - first)
+    return;
+
+  // Regions beginning after `lastLine` can't overlap; of the rest, walk back
+  // until no earlier region reaches as far as `firstLine`
+  const IndexRegionEntry *begin = Regions + first;
+  const IndexRegionEntry *end = std::upper_bound(
+      begin, begin + count, lastLine,
+      [](unsigned line, const IndexRegionEntry &entry) {
+        return line < entry.BeginLine;
+      });
+  SmallVector<uint32_t, 32> found;
+  for (const IndexRegionEntry *entry = end; entry != begin;) {
+    --entry;
+    if (entry->MaxEndLine < firstLine)
+      break;
+    if (entry->EndLine >= firstLine)
+      found.push_back(entry - Regions);
+  }
+  uint32_t fileIndex = file - Files;
+  for (auto i = found.rbegin(); i != found.rend(); ++i)
+    callback(GetRegion(fileIndex, *i));
+}
+
+void RegionIndex::FindVariableRegions(
+    StringRef name, function_ref<void(const Region &)> callback) const {
+  uint32_t nameIndex;
+  if (!FindString(name, nameIndex))
+    return;
+  const IndexVariableEntry *variablesEnd = Variables + Header->NumVariables;
+  const IndexVariableEntry *variable = std::lower_bound(
+      Variables, variablesEnd, nameIndex,
+      [](const IndexVariableEntry &entry, uint32_t name) {
+        return entry.Name < name;
+      });
+  if (variable == variablesEnd || variable->Name != nameIndex)
+    return;
+  uint32_t first = variable->FirstReference;
+  uint32_t count = variable->NumReferences;
+  if (first > Header->NumReferences || count > Header->NumReferences - first)
+    return;
+
+  const IndexFileEntry *filesEnd = Files + Header->NumFiles;
+  for (uint32_t i = first; i < first + count; ++i) {
+    uint32_t regionIndex = References[i];
+    if (regionIndex >= Header->NumRegions)
+      continue;
+    // The file whose regions include this one
+    const IndexFileEntry *file = std::upper_bound(
+        Files, filesEnd, regionIndex,
+        [](uint32_t region, const IndexFileEntry &entry) {
+          return region < entry.FirstRegion;
+        });
+    if (file == Files)
+      continue;
+    callback(GetRegion(file - 1 - Files, regionIndex));
+  }
+}
+
+} // namespace dbgcov
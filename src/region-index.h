@@ -0,0 +1,131 @@
+#ifndef DBGCOV_REGION_INDEX_H
+#define DBGCOV_REGION_INDEX_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "regions.h"
+
+/* Merged region index, as written by `dbgcov-merge`.
+ *
+ * The file is laid out so that it can be mapped and queried in place, without
+ * reading it all first. All integers are little-endian and every table is
+ * 4-byte aligned.
+ *
+ *   header:      magic "DBGCOVI\0", uint32 version, uint32 counts of strings,
+ *                files, regions, variables and variable references, then the
+ *                uint64 file offset of each of the tables below
+ *   strings:     uint32 offset of each string within the string data, plus
+ *                the offset of the end; strings are sorted and unique, so
+ *                comparing string indices compares the strings
+ *   string data: the strings' bytes, without terminators
+ *   files:       per file, sorted by path: uint32 path string index, first
+ *                region index and region count
+ *   regions:     sorted by file, begin line, begin column, end line, end
+ *                column, kind and detail, without duplicates; per region,
+ *                uint32 begin line, begin column, end line, end column,
+ *                detail string index, the greatest end line of this and the
+ *                file's earlier regions (which bounds the search for regions
+ *                covering a line), and kind
+ *   variables:   per variable (detail of a non-`Computation` region), sorted
+ *                by name: uint32 name string index, first reference and
+ *                reference count
+ *   references:  uint32 region indices, in region order for each variable
+ */
+
+namespace dbgcov {
+
+const char IndexMagic[8] = {'D', 'B', 'G', 'C', 'O', 'V', 'I', '\0'};
+const uint32_t IndexVersion = 1;
+
+struct IndexHeader;
+struct IndexFileEntry;
+struct IndexRegionEntry;
+struct IndexVariableEntry;
+
+// Collects regions from any number of `.dbgcov` files and writes the index
+class RegionIndexBuilder {
+public:
+  void AddRegion(const Region &region);
+  // Sort, deduplicate and write everything added so far
+  llvm::Error Write(llvm::raw_ostream &OS) const;
+
+private:
+  // A region with interned strings
+  struct PendingRegion {
+    uint32_t Path;
+    uint32_t BeginLine;
+    uint32_t BeginColumn;
+    uint32_t EndLine;
+    uint32_t EndColumn;
+    uint32_t Detail;
+    RegionKind Kind;
+  };
+
+  uint32_t GetStringId(llvm::StringRef str);
+
+  // The map owns the strings
+  llvm::StringMap<uint32_t> StringIds;
+  std::vector<llvm::StringRef> Strings;
+  std::vector<PendingRegion> Regions;
+};
+
+// Read-only view of an index file. Opening one only checks the header, so
+// the cost of a lookup is a few binary searches over the mapped file.
+class RegionIndex {
+public:
+  static llvm::Expected<std::unique_ptr<RegionIndex>>
+  Open(llvm::StringRef path);
+  static llvm::Expected<std::unique_ptr<RegionIndex>>
+  Create(std::unique_ptr<llvm::MemoryBuffer> buffer);
+
+  uint32_t GetNumFiles() const;
+  uint32_t GetNumRegions() const;
+  uint32_t GetNumVariables() const;
+
+  // Regions of the file at `path` overlapping lines `firstLine` to `lastLine`
+  // inclusive, in index order
+  void FindRegions(llvm::StringRef path, unsigned firstLine, unsigned lastLine,
+                   llvm::function_ref<void(const Region &)> callback) const;
+  // Regions of the file at `path` covering `line`
+  void FindRegionsAt(llvm::StringRef path, unsigned line,
+                     llvm::function_ref<void(const Region &)> callback) const {
+    FindRegions(path, line, line, callback);
+  }
+  // Regions naming the variable with extended name `name`
+  void FindVariableRegions(
+      llvm::StringRef name,
+      llvm::function_ref<void(const Region &)> callback) const;
+
+private:
+  explicit RegionIndex(std::unique_ptr<llvm::MemoryBuffer> buffer)
+      : Buffer(std::move(buffer)) {}
+  llvm::Error Initialise();
+
+  llvm::StringRef GetString(uint32_t index) const;
+  bool FindString(llvm::StringRef str, uint32_t &index) const;
+  Region GetRegion(uint32_t fileIndex, uint32_t regionIndex) const;
+
+  std::unique_ptr<llvm::MemoryBuffer> Buffer;
+  const IndexHeader *Header = nullptr;
+  const llvm::support::ulittle32_t *StringOffsets = nullptr;
+  const char *StringData = nullptr;
+  uint64_t StringDataSize = 0;
+  const IndexFileEntry *Files = nullptr;
+  const IndexRegionEntry *Regions = nullptr;
+  const IndexVariableEntry *Variables = nullptr;
+  const llvm::support::ulittle32_t *References = nullptr;
+};
+
+} // namespace dbgcov
+
+#endif
@@ -0,0 +1,25 @@
+#include "region-reader.h"
+
+#include <string>
+
+#include "binary-format.h"
+#include "compressed-output.h"
+
+using namespace llvm;
+
+namespace dbgcov {
+
+Error ReadRegions(StringRef data,
+                  function_ref<void(const Region &)> callback) {
+  if (IsCompressedRegionData(data)) {
+    std::string decompressed;
+    if (Error error = DecompressRegionData(data, decompressed))
+      return error;
+    return ReadRegions(decompressed, callback);
+  }
+  if (IsBinaryRegionData(data))
+    return ReadBinaryRegions(data, callback);
+  return ReadTextRegions(data, callback);
+}
+
+} // namespace dbgcov
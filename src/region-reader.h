@@ -0,0 +1,19 @@
+#ifndef DBGCOV_REGION_READER_H
+#define DBGCOV_REGION_READER_H
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+
+#include "regions.h"
+
+namespace dbgcov {
+
+// Read `.dbgcov` data in whichever output format it is in, compressed or not.
+// Strings passed to `callback` are only valid during the call.
+llvm::Error ReadRegions(llvm::StringRef data,
+                        llvm::function_ref<void(const Region &)> callback);
+
+} // namespace dbgcov
+
+#endif
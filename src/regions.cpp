@@ -0,0 +1,73 @@
+#include "regions.h"
+
+using namespace llvm;
+
+namespace dbgcov {
+
+static const char *const RegionKindNames[NumRegionKinds] = {
+  "Computation",
+  "DeclScope",
+  "MustBeDefined",
+  "MayBeDefined",
+};
+
+StringRef GetRegionKindName(RegionKind kind) {
+  assert(static_cast<unsigned>(kind) < NumRegionKinds && "Invalid kind");
+  return RegionKindNames[static_cast<unsigned>(kind)];
+}
+
+bool ParseRegionKind(StringRef name, RegionKind &kind) {
+  for (unsigned i = 0; i < NumRegionKinds; ++i) {
+    if (name == RegionKindNames[i]) {
+      kind = static_cast<RegionKind>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void TextRegionSink::AddRegion(const Region &region) {
+  OS << region.Path << ":" << region.BeginLine << ":" << region.BeginColumn
+     << "\t" << region.Path << ":" << region.EndLine << ":" << region.EndColumn
+     << "\t" << GetRegionKindName(region.Kind) << "\t" << region.Detail << "\n";
+}
+
+// Split "<path>:<line>:<col>", where the path may itself contain colons
+static bool ParseLocation(StringRef text, StringRef &path, unsigned &line,
+                          unsigned &column) {
+  StringRef rest, lineText, columnText;
+  std::tie(rest, columnText) = text.rsplit(':');
+  std::tie(path, lineText) = rest.rsplit(':');
+  return !path.empty() && !lineText.getAsInteger(10, line) &&
+         !columnText.getAsInteger(10, column);
+}
+
+Error ReadTextRegions(StringRef data,
+                      function_ref<void(const Region &)> callback) {
+  unsigned lineNumber = 0;
+  while (!data.empty()) {
+    StringRef line;
+    std::tie(line, data) = data.split('\n');
+    ++lineNumber;
+    if (line.empty())
+      continue;
+
+    StringRef begin, end, kind, detail;
+    std::tie(begin, line) = line.split('\t');
+    std::tie(end, line) = line.split('\t');
+    std::tie(kind, detail) = line.split('\t');
+    Region region;
+    StringRef endPath;
+    if (!ParseLocation(begin, region.Path, region.BeginLine,
+                       region.BeginColumn) ||
+        !ParseLocation(end, endPath, region.EndLine, region.EndColumn) ||
+        endPath != region.Path || !ParseRegionKind(kind, region.Kind))
+      return createStringError(inconvertibleErrorCode(),
+                               "malformed region on line %u", lineNumber);
+    region.Detail = detail;
+    callback(region);
+  }
+  return Error::success();
+}
+
+} // namespace dbgcov
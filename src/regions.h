@@ -0,0 +1,75 @@
+#ifndef DBGCOV_REGIONS_H
+#define DBGCOV_REGIONS_H
+
+#include <cstdint>
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace dbgcov {
+
+// The kinds of region we report. The numbering is part of the binary output
+// format, so only ever append to this list.
+enum class RegionKind : uint8_t {
+  Computation,
+  DeclScope,
+  MustBeDefined,
+  MayBeDefined,
+};
+
+const unsigned NumRegionKinds = 4;
+
+// Name used for each kind in the text output
+llvm::StringRef GetRegionKindName(RegionKind kind);
+// Inverse of the above; returns false for unknown names
+bool ParseRegionKind(llvm::StringRef name, RegionKind &kind);
+
+// A single resolved region. Both ends are in the same file (multi-file regions
+// are dropped before they get this far), so only one path is kept.
+// The strings are owned elsewhere and must outlive any sink they are given to.
+struct Region {
+  llvm::StringRef Path;
+  unsigned BeginLine;
+  unsigned BeginColumn;
+  unsigned EndLine;
+  unsigned EndColumn;
+  RegionKind Kind;
+  // Statement type for `Computation` regions, extended variable name otherwise
+  llvm::StringRef Detail;
+};
+
+// Somewhere to send regions as they are found
+class RegionSink {
+public:
+  virtual ~RegionSink() {}
+  virtual void AddRegion(const Region &region) = 0;
+  // Called before the regions of each top-level declaration: `name` and
+  // `path:line` locate it if it is a function definition, and are empty
+  // otherwise. Only needed by sinks that group regions by function.
+  virtual void BeginFunction(llvm::StringRef name, llvm::StringRef path,
+                             unsigned line) {}
+  // Called once all regions of a translation unit have been added
+  virtual void Finish() {}
+};
+
+// The original tab-separated format, one region per line:
+// <path>:<line>:<col>\t<path>:<line>:<col>\t<kind>\t<detail>
+class TextRegionSink : public RegionSink {
+public:
+  explicit TextRegionSink(llvm::raw_ostream &OS) : OS(OS) {}
+  void AddRegion(const Region &region) override;
+
+private:
+  llvm::raw_ostream &OS;
+};
+
+// Parse text written by `TextRegionSink`. Strings passed to `callback` point
+// into `data`.
+llvm::Error ReadTextRegions(llvm::StringRef data,
+                            llvm::function_ref<void(const Region &)> callback);
+
+} // namespace dbgcov
+
+#endif
@@ -0,0 +1,144 @@
+#include "server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace dbgcov {
+
+// Read the whole request; clients send it in one go and then wait for us
+static bool ReadRequest(int fd, std::string &buffer) {
+  char chunk[4096];
+  while (std::count(buffer.begin(), buffer.end(), '\n') < 3) {
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    buffer.append(chunk, n);
+  }
+  return true;
+}
+
+static void HandleConnection(int fd, ServerHandler handler) {
+  std::string buffer;
+  if (!ReadRequest(fd, buffer)) {
+    close(fd);
+    return;
+  }
+  SmallVector<StringRef, 3> lines;
+  StringRef(buffer).split(lines, '\n', /* MaxSplit = */ 3,
+                          /* KeepEmpty = */ true);
+  ServerRequest request;
+  request.WorkingDirectory = lines[0];
+  request.InputPath = lines[1];
+  request.OutputPath = lines[2];
+
+  int status = handler(request);
+
+  SmallString<16> reply;
+  raw_svector_ostream(reply) << status << "\n";
+  // The client may have gone away, in which case there is no one to tell
+  (void)!write(fd, reply.data(), reply.size());
+  close(fd);
+}
+
+int RunServer(StringRef socketPath, unsigned numThreads,
+              ServerHandler handler) {
+  // Clients that give up on us shouldn't take the server down
+  signal(SIGPIPE, SIG_IGN);
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(addr.sun_path)) {
+    errs() << "Error: server socket path too long: " << socketPath << "\n";
+    return 1;
+  }
+  memcpy(addr.sun_path, socketPath.data(), socketPath.size());
+
+  int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0) {
+    errs() << "Error: socket: " << strerror(errno) << "\n";
+    return 1;
+  }
+  // Replace any socket left behind by a previous server
+  unlink(addr.sun_path);
+  if (bind(listenFd, reinterpret_cast<struct sockaddr *>(&addr),
+           sizeof(addr)) < 0 ||
+      listen(listenFd, SOMAXCONN) < 0) {
+    errs() << "Error: unable to listen on " << socketPath << ": "
+           << strerror(errno) << "\n";
+    close(listenFd);
+    return 1;
+  }
+  errs() << "dbgcov-tool: serving requests on " << socketPath << "\n";
+
+  // Parallel builds send many requests at once, so don't serialise them; but
+  // each one is a whole Clang parse, so only run `numThreads` at a time. The
+  // rest wait here, accepted, until a worker is free.
+  std::mutex queueMutex;
+  std::condition_variable queueNonEmpty;
+  std::deque<int> queue;
+  bool stopping = false;
+  auto worker = [&]() {
+    while (true) {
+      int fd;
+      {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueNonEmpty.wait(lock, [&] { return stopping || !queue.empty(); });
+        if (queue.empty())
+          return;
+        fd = queue.front();
+        queue.pop_front();
+      }
+      HandleConnection(fd, handler);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < std::max(1u, numThreads); ++i)
+    threads.emplace_back(worker);
+
+  while (true) {
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      errs() << "Error: accept: " << strerror(errno) << "\n";
+      close(listenFd);
+      // Answer the requests already accepted before giving up
+      {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+      }
+      queueNonEmpty.notify_all();
+      for (auto &thread : threads)
+        thread.join();
+      return 1;
+    }
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      queue.push_back(fd);
+    }
+    queueNonEmpty.notify_one();
+  }
+}
+
+} // namespace dbgcov
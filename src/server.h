@@ -0,0 +1,35 @@
+#ifndef DBGCOV_SERVER_H
+#define DBGCOV_SERVER_H
+
+#include <functional>
+
+#include "llvm/ADT/StringRef.h"
+
+namespace dbgcov {
+
+/* A request from a client, which the driver sends as three lines:
+ *
+ *   <client working directory>
+ *   <input path>
+ *   <output path>
+ *
+ * The server replies with the analysis exit status on one line and closes the
+ * connection. Relative paths are relative to the client's directory.
+ */
+struct ServerRequest {
+  llvm::StringRef WorkingDirectory;
+  llvm::StringRef InputPath;
+  llvm::StringRef OutputPath;
+};
+
+using ServerHandler = std::function<int(const ServerRequest &)>;
+
+// Listen on a Unix domain socket at `socketPath`, running `handler` for each
+// request on one of `numThreads` worker threads; further requests wait for a
+// free worker. Only returns if the socket cannot be set up or used.
+int RunServer(llvm::StringRef socketPath, unsigned numThreads,
+              ServerHandler handler);
+
+} // namespace dbgcov
+
+#endif
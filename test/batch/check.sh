@@ -0,0 +1,42 @@
+#!/usr/bin/env bash
+# Check that -batch writes for each input exactly what a separate run writes,
+# whether the inputs are listed or (with only -p) taken from a compilation
+# database, and that it fails cleanly when given neither.
+
+. "$(dirname "$0")/../check-lib.sh"
+requireBuilt dbgcov-tool
+TOOL="$SRC/dbgcov-tool"
+
+inputs="var-def var-def-cfg var-def-for"
+echo '[' > compile_commands.json
+sep=
+for name in $inputs; do
+    "$CC" -std=c99 -E -o $name.i "$here/../$name/$name.c"
+    "$TOOL" $name.i -- -std=c99 > $name.expected
+    printf '%s{ "directory": "%s", "file": "%s.i", "command": "cc -std=c99 -c %s.i" }\n' \
+        "$sep" "$work" $name $name >> compile_commands.json
+    sep=,
+done
+echo ']' >> compile_commands.json
+
+check () {
+    for name in $inputs; do
+        if ! diff -u $name.expected $name.i.dbgcov; then
+            echo "check.sh: -batch output for $name differs ($1)" 1>&2
+            status=1
+        fi
+        rm -f $name.i.dbgcov
+    done
+}
+
+"$TOOL" -batch -jobs=2 $(for name in $inputs; do echo $name.i; done) -- -std=c99
+check "inputs listed"
+"$TOOL" -batch -jobs=2 -p .
+check "compilation database"
+
+if "$TOOL" -batch 2> none.err || ! grep -q "^Error: no input files" none.err; then
+    echo "check.sh: -batch with no inputs or database did not fail cleanly" 1>&2
+    cat none.err 1>&2
+    status=1
+fi
+finish "-batch output matches separate runs ($(echo $inputs | wc -w) inputs)"
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""Benchmark dbgcov-tool on synthetic and realistic inputs.
+
+Usage: bench.py [--scale N] [--tool PATH] [--modes M,...] [--variant FLAGS ...]
+                [extra.c|extra.i ...]
+
+For each input and `-definedness` mode, reports the wall time, regions per second and peak RSS of a
+`dbgcov-tool` run, plus the tool's own split of its time into parsing,
+traversal and region output (from `-phase-timings`). Extra inputs, e.g. a
+preprocessed amalgamation of some large project, can be given on the command
+line or in BENCH_INPUTS. Each `--variant` (e.g. `--variant=-output-thread`)
+adds a run with those extra tool flags to compare against the plain one.
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+PREFIX = os.environ.get("DBGCOV_PREFIX",
+                        os.path.normpath(os.path.join(HERE, "..", "..")))
+CC = os.environ.get("CC", "gcc")
+
+SHAPES = ["many-functions", "long-function", "deep-expression",
+          "assignment-chain", "big-switch", "call-arguments"]
+# Realistic sources, and the flags to preprocess them with
+REALISTIC = [("realistic-libc.c", ["-O2"])]
+
+TIMINGS = re.compile(r"phase timings for .*: parse ([0-9.]+)s "
+                     r"traversal ([0-9.]+)s emission ([0-9.]+)s "
+                     r"regions ([0-9]+)")
+
+
+def preprocess(source, output, flags):
+    subprocess.check_call([CC, "-std=gnu99", "-E", "-o", output, source]
+                          + flags)
+
+
+def run_tool(tool, mode, flags, input_path, output_path):
+    with open(output_path, "wb") as out:
+        start = time.monotonic()
+        proc = subprocess.Popen([tool, "-phase-timings",
+                                 "-definedness=" + mode] + flags
+                                + [input_path, "--"],
+                                stdout=out, stderr=subprocess.PIPE)
+        stderr = proc.stderr.read().decode(errors="replace")
+        # wait4 gives this child's own peak RSS (in KiB on Linux)
+        _, status, usage = os.wait4(proc.pid, 0)
+        wall = time.monotonic() - start
+    proc.returncode = os.waitstatus_to_exitcode(status)
+    if proc.returncode != 0:
+        sys.stderr.write(stderr)
+        raise RuntimeError(f"{input_path}: dbgcov-tool exited with "
+                           f"status {proc.returncode}")
+    match = TIMINGS.search(stderr)
+    if not match:
+        raise RuntimeError(f"{input_path}: no phase timings in tool output")
+    parse, traversal, emission = (float(x) for x in match.groups()[:3])
+    return {
+        "wall": wall,
+        "rss": usage.ru_maxrss / 1024.0,
+        "parse": parse,
+        "traversal": traversal,
+        "emission": emission,
+        "regions": int(match.group(4)),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--scale", type=int, default=1,
+                        help="size multiplier for the synthetic inputs")
+    parser.add_argument("--tool",
+                        default=os.path.join(PREFIX, "src", "dbgcov-tool"))
+    parser.add_argument("--modes", default="lexical,cfg",
+                        help="comma-separated -definedness modes to compare")
+    parser.add_argument("--variant", action="append", default=[],
+                        help="extra tool flags (space-separated) for an "
+                        "additional run of each input and mode")
+    parser.add_argument("inputs", nargs="*",
+                        default=os.environ.get("BENCH_INPUTS", "").split())
+    args = parser.parse_args()
+    if not os.access(args.tool, os.X_OK):
+        sys.exit(f"bench.py: build {args.tool} first")
+
+    with tempfile.TemporaryDirectory() as work:
+        inputs = []
+        for shape in SHAPES:
+            source = os.path.join(work, shape + ".c")
+            with open(source, "w") as f:
+                subprocess.check_call(
+                    [sys.executable, os.path.join(HERE, "gen-synthetic.py"),
+                     shape, str(args.scale)], stdout=f)
+            inputs.append((shape, source, []))
+        for name, flags in REALISTIC:
+            inputs.append((os.path.splitext(name)[0], os.path.join(HERE, name),
+                           flags))
+        for path in args.inputs:
+            inputs.append((os.path.splitext(os.path.basename(path))[0],
+                           os.path.abspath(path), []))
+
+        variants = [""] + args.variant
+        print(f"{'input':<22} {'mode':<8} {'flags':<16} {'KiB':>8} "
+              f"{'regions':>9} "
+              f"{'wall s':>8} "
+              f"{'regions/s':>10} {'RSS MiB':>8} {'parse s':>8} "
+              f"{'trav s':>8} {'emit s':>8}")
+        for name, source, flags in inputs:
+            if source.endswith(".i"):
+                preprocessed = source
+            else:
+                preprocessed = os.path.join(work, name + ".i")
+                preprocess(source, preprocessed, flags)
+            size = os.path.getsize(preprocessed) / 1024.0
+            for mode in args.modes.split(","):
+                for variant in variants:
+                    result = run_tool(args.tool, mode, variant.split(),
+                                      preprocessed,
+                                      os.path.join(work, name + ".dbgcov"))
+                    rate = (result["regions"] / result["wall"]
+                            if result["wall"] else 0)
+                    print(f"{name:<22} {mode:<8} {variant or '-':<16} "
+                          f"{size:>8.0f} "
+                          f"{result['regions']:>9} {result['wall']:>8.3f} "
+                          f"{rate:>10.0f} {result['rss']:>8.1f} "
+                          f"{result['parse']:>8.3f} {result['traversal']:>8.3f} "
+                          f"{result['emission']:>8.3f}", flush=True)
+
+
+if __name__ == "__main__":
+    main()
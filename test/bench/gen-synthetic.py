@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+"""Generate synthetic C sources that stress particular parts of dbgcov-tool.
+
+Usage: gen-synthetic.py SHAPE [SCALE] > file.c
+
+Each shape grows linearly with SCALE (default 1), so doubling SCALE should
+roughly double the tool's running time. Anything worse than that is the kind
+of regression the benchmarks are here to catch.
+"""
+
+import sys
+
+
+def many_functions(scale):
+    """Lots of small functions: per-top-level-decl overhead."""
+    out = []
+    for i in range(2000 * scale):
+        out.append(f"""int f{i}(int a, int b)
+{{
+\tint c = a + b;
+\tif (c > {i})
+\t\tc -= b;
+\treturn c * a;
+}}
+""")
+    return out
+
+
+def long_function(scale):
+    """One huge function body: many statements under one parent."""
+    out = ["int long_function(int x)\n{\n\tint acc = 0;\n"]
+    for i in range(20000 * scale):
+        out.append(f"\tint v{i} = x + {i};\n\tacc += v{i};\n")
+        if i % 10 == 0:
+            out.append(f"\tif (acc > {i}) acc -= v{i};\n")
+    out.append("\treturn acc;\n}\n")
+    return out
+
+
+def deep_expression(scale):
+    """Deeply nested expressions: large trees under one assignment."""
+    out = []
+    for i in range(50 * scale):
+        depth = 200
+        expr = "x"
+        for d in range(depth):
+            expr = f"({expr} {'+-*^'[d % 4]} y{d % 8})"
+        out.append(f"int deep{i}(int x, int y0, int y1, int y2, int y3, "
+                   f"int y4, int y5, int y6, int y7)\n{{\n"
+                   f"\tint r;\n\tr = {expr};\n\treturn r;\n}}\n")
+    return out
+
+
+def assignment_chain(scale):
+    """Chained assignments: each `=` reports every variable on its left."""
+    out = []
+    for i in range(100 * scale):
+        names = [f"a{j}" for j in range(100)]
+        decls = "".join(f"\tint {n};\n" for n in names)
+        chain = " = ".join(names)
+        out.append(f"int chain{i}(int x)\n{{\n{decls}\t{chain} = x;\n"
+                   f"\treturn a0 + a99;\n}}\n")
+    return out
+
+
+def big_switch(scale):
+    """Large switch statements with declarations in the cases."""
+    out = []
+    for i in range(20 * scale):
+        cases = "".join(
+            f"\tcase {c}:\n\t\ty = x * {c};\n\t\tbreak;\n" for c in range(500))
+        out.append(f"int switch{i}(int x)\n{{\n\tint y = 0;\n"
+                   f"\tswitch (x)\n\t{{\n{cases}\tdefault:\n\t\ty = -1;\n"
+                   f"\t}}\n\treturn y;\n}}\n")
+    return out
+
+
+def call_arguments(scale):
+    """Calls with many arguments, some taking variables' addresses."""
+    params = ", ".join(f"int *p{j}" for j in range(64))
+    out = [f"int sink({params});\n"]
+    for i in range(200 * scale):
+        locals_ = "".join(f"\tint v{j} = x + {j};\n" for j in range(64))
+        args = ", ".join(f"&v{j}" for j in range(64))
+        out.append(f"int call{i}(int x)\n{{\n{locals_}"
+                   f"\tsink({args});\n\tsink({args});\n"
+                   f"\treturn v0 + v63;\n}}\n")
+    return out
+
+
+SHAPES = {
+    "many-functions": many_functions,
+    "long-function": long_function,
+    "deep-expression": deep_expression,
+    "assignment-chain": assignment_chain,
+    "big-switch": big_switch,
+    "call-arguments": call_arguments,
+}
+
+
+def main():
+    if len(sys.argv) not in (2, 3) or sys.argv[1] not in SHAPES:
+        sys.stderr.write(__doc__)
+        sys.stderr.write("Shapes: " + " ".join(SHAPES) + "\n")
+        sys.exit(1)
+    scale = int(sys.argv[2]) if len(sys.argv) == 3 else 1
+    sys.stdout.write("".join(SHAPES[sys.argv[1]](scale)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,57 @@
+/* A "realistic" input: most of the C library's headers, preprocessed with
+ * optimisation on (see bench.py) so that glibc's inline function definitions
+ * are included. Real code bases include these in nearly every file. */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <locale.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+
+static int count_words(const char *s)
+{
+	int n = 0, in_word = 0;
+	for (; *s; ++s)
+	{
+		if (isspace((unsigned char) *s))
+			in_word = 0;
+		else if (!in_word)
+		{
+			in_word = 1;
+			++n;
+		}
+	}
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	int total = 0;
+	for (int i = 1; i < argc; ++i)
+	{
+		char *copy = strdup(argv[i]);
+		total += count_words(copy);
+		free(copy);
+	}
+	printf("%d\n", total);
+	return 0;
+}
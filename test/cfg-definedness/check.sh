@@ -0,0 +1,35 @@
+#!/usr/bin/env bash
+# Check the MustBeDefined runs that -definedness=cfg finds in var-def-cfg.c:
+# `a` and `b` are assigned on both arms of an if, so are defined for all paths
+# after it; `unstructured` is assigned out of line order, through gotos; and
+# `step`, a loop-local without an initialiser, is only defined after its
+# assignment in each iteration, however the previous one left it.
+
+. "$(dirname "$0")/../check-lib.sh"
+requireBuilt dbgcov-tool
+
+cp "$here/../var-def-cfg/var-def-cfg.c" .
+"$CC" -std=c99 -E -o var-def-cfg.i var-def-cfg.c
+"$SRC/dbgcov-tool" -definedness=cfg -kinds=MustBeDefined var-def-cfg.i -- > cfg.dbgcov
+
+# The whole-line runs for a variable, as first-last, one per line
+runs () {
+    awk -F '\t' -v var="$1" '$4 == var {
+        n = split($1, b, ":"); split($2, e, ":")
+        print b[n - 1] "-" e[n - 1]
+    }' cfg.dbgcov | tr '\n' ' '
+}
+
+expect () {
+    actual="$(runs "$1")"
+    if [ "$actual" != "$2 " ]; then
+        echo "check.sh: $1 is defined on $actual, not $2" 1>&2
+        status=1
+    fi
+}
+
+expect "example, a, decl var-def-cfg.c:9" "13-13 20-37"
+expect "example, b, decl var-def-cfg.c:9" "20-20 28-37"
+expect "example, unstructured, decl var-def-cfg.c:7" "36-37"
+expect "loop, step, decl var-def-cfg.c:42" "45-45"
+finish "-definedness=cfg finds the expected runs ($(wc -l < cfg.dbgcov) regions)"
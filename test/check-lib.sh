@@ -0,0 +1,40 @@
+# The test directories with a check.sh aren't analysis tests like the others
+# (which build their sources through the wrapper, with rules.mk): each checks
+# one feature of the tools end to end, and is run with `make -C test/<dir>`.
+#
+# Their check.sh scripts source this file, as
+#
+#   . "$(dirname "$0")/../check-lib.sh"
+#
+# It leaves the script in a scratch directory (removed on exit) with `here`
+# (the script's own directory), `SRC` (where the tools are built) and `CC` set.
+# The script sets `status` to 1 on each failure and ends with `finish`.
+
+set -e
+here="$(cd "$(dirname "$0")" && pwd)"
+DBGCOV_PREFIX="${DBGCOV_PREFIX:-$(cd "$here/../.." && pwd)}"
+SRC="$DBGCOV_PREFIX/src"
+CC="${CC:-gcc}"
+
+# Give up unless each file (a path, or the name of a tool in $SRC) is built
+requireBuilt () {
+    for f in "$@"; do
+        case "$f" in
+            */*) ;;
+            *) f="$SRC/$f" ;;
+        esac
+        [ -e "$f" ] || { echo "check.sh: build $f first" 1>&2; exit 1; }
+    done
+}
+
+work="$(mktemp -d)"
+trap 'rm -rf "$work"' EXIT
+cd "$work"
+
+status=0
+
+# Exit with the accumulated status, printing the arguments if all was well
+finish () {
+    [ $status -ne 0 ] || echo "check.sh: $*"
+    exit $status
+}
@@ -0,0 +1,29 @@
+#!/usr/bin/env bash
+# Check dbgcov-compare on a small function. Without optimisation, every
+# variable lives on the stack for the whole function, so the debug info must
+# cover every line the regions say it is defined on. With optimisation we only
+# check that each variable is matched and reported.
+
+. "$(dirname "$0")/../check-lib.sh"
+requireBuilt dbgcov-tool dbgcov-compare
+
+cp "$here/compare.c" compare.c
+"$CC" -std=c99 -E -o compare.i compare.c
+"$SRC/dbgcov-tool" -o compare.dbgcov compare.i --
+
+for opt in -O0 -O2; do
+    "$CC" -std=c99 -g $opt -c -o compare$opt.o compare.i
+    "$SRC/dbgcov-compare" -variables compare$opt.o compare.dbgcov > compare$opt.txt
+    for var in n scale total result; do
+        if ! grep -q "^variable	sum, $var, decl compare.c:" compare$opt.txt; then
+            echo "check.sh: $opt: no coverage reported for $var" 1>&2
+            status=1
+        fi
+    done
+done
+if ! grep -q "^total		\([0-9]*\)	\1	1.0000$" compare-O0.txt; then
+    echo "check.sh: -O0 coverage is incomplete:" 1>&2
+    cat compare-O0.txt 1>&2
+    status=1
+fi
+finish "dbgcov-compare OK ($(grep '^total' compare-O2.txt | cut -f5) coverage at -O2)"
@@ -0,0 +1,11 @@
+int step(int);
+
+int sum(int n, int scale)
+{
+  int total = 0;
+  int i;
+  for (i = 0; i < n; i++)
+    total += step(i) * scale;
+  int result = total / 2;
+  return result;
+}
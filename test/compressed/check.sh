@@ -0,0 +1,38 @@
+#!/usr/bin/env bash
+# Check that -compress loses nothing: for each compression LLVM supports and
+# each output format, dbgcov-dump of the compressed output (written with -o)
+# must match the plain text output, as must a query of its merged index.
+
+. "$(dirname "$0")/../check-lib.sh"
+requireBuilt dbgcov-tool dbgcov-dump dbgcov-merge dbgcov-query
+
+cp "$here/../var-def-cfg/var-def-cfg.c" compressed.c
+"$CC" -std=c99 -E -o compressed.i compressed.c
+"$SRC/dbgcov-tool" compressed.i -- > plain.dbgcov
+"$SRC/dbgcov-merge" -o plain.dbgcovi plain.dbgcov
+"$SRC/dbgcov-query" plain.dbgcovi -range="$work/compressed.c:1-1000" > plain.query
+
+checked=0
+for compression in zlib zstd; do
+    for format in text binary; do
+        out="$compression-$format.dbgcov"
+        if ! "$SRC/dbgcov-tool" -compress=$compression -output-format=$format \
+                -o "$out" compressed.i -- 2> "$out.err"; then
+            if grep -q "LLVM was built without" "$out.err"; then
+                echo "check.sh: skipping $compression (not in this LLVM)"
+                break
+            fi
+            cat "$out.err" 1>&2
+            exit 1
+        fi
+        "$SRC/dbgcov-dump" "$out" > "$out.txt"
+        "$SRC/dbgcov-merge" -o "$out.i" "$out"
+        "$SRC/dbgcov-query" "$out.i" -range="$work/compressed.c:1-1000" > "$out.query"
+        if ! diff -u plain.dbgcov "$out.txt" || ! diff -u plain.query "$out.query"; then
+            echo "check.sh: $out does not read back as the plain output" 1>&2
+            status=1
+        fi
+        checked=$((checked + 1))
+    done
+done
+finish "compressed output matches ($checked variants, $(wc -l < plain.dbgcov) regions)"
@@ -0,0 +1,6 @@
+#include "shared.h"
+
+int a(int x) {
+  int y = clamp(x, 0, 10);
+  return y * 2;
+}
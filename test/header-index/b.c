@@ -0,0 +1,6 @@
+#include "shared.h"
+
+int b(int x) {
+  int y = clamp(x, -10, 0);
+  return y - 1;
+}
@@ -0,0 +1,39 @@
+#!/usr/bin/env bash
+# Check -header-functions=once: in a build of a.c and b.c, which both include
+# shared.h, only a.c (analysed first) reports shared.h's function. Rebuilding
+# a.c alone against the same index must report it again, and rebuilding b.c
+# must still not.
+
+. "$(dirname "$0")/../check-lib.sh"
+requireBuilt dbgcov-tool
+TOOL="$SRC/dbgcov-tool"
+cp "$here/a.c" "$here/b.c" "$here/shared.h" .
+
+analyse () {
+    "$TOOL" -header-functions=once -header-index=index $1.i -- > $1.dbgcov
+}
+
+for name in a b; do
+    "$CC" -std=c99 -E -o $name.i $name.c
+    analyse $name
+    mv $name.dbgcov $name.first.dbgcov
+done
+
+if ! grep -q "/shared\.h:" a.first.dbgcov; then
+    echo "check.sh: a.c did not report shared.h's function" 1>&2
+    status=1
+fi
+if grep -q "/shared\.h:" b.first.dbgcov; then
+    echo "check.sh: b.c reported shared.h's function as well" 1>&2
+    status=1
+fi
+
+for name in a b; do
+    analyse $name
+    if ! diff -u $name.first.dbgcov $name.dbgcov; then
+        echo "check.sh: rebuilding $name.c alone changed its output" 1>&2
+        status=1
+    fi
+done
+
+finish "header functions reported once ($(grep -c "/shared\.h:" a.dbgcov) regions)"
@@ -0,0 +1,8 @@
+static inline int clamp(int x, int lo, int hi) {
+  int result = x;
+  if (result < lo)
+    result = lo;
+  if (result > hi)
+    result = hi;
+  return result;
+}
@@ -0,0 +1,46 @@
+#include <stdio.h>
+
+/* Added lines move every function below down, so their cached regions need
+ * shifting. */
+typedef int T;
+
+static int total;
+static int calls;
+
+int square(int x)
+{
+	int y = x * x;
+	return y;
+}
+
+int sum(int n)
+{
+	int i, s = 0;
+	/* Edited: this function has to be re-analysed */
+	for (i = 0; i < n; ++i)
+	{
+		s += square(i);
+		++calls;
+	}
+	return s;
+}
+
+int cast_or_multiply(int *p)
+{
+	int T = 3;
+	return (T)*p;
+}
+
+int main(int argc, char **argv)
+{
+	int n = argc * 10;
+	total = sum(n);
+	if (total > 100)
+		printf("%d\n", total);
+	else
+	{
+		int k = cast_or_multiply(&n);
+		printf("%d %d %d\n", total, k, calls);
+	}
+	return 0;
+}
@@ -0,0 +1,39 @@
+#include <stdio.h>
+
+typedef int T;
+
+static int total;
+
+int square(int x)
+{
+	int y = x * x;
+	return y;
+}
+
+int sum(int n)
+{
+	int i, s = 0;
+	for (i = 0; i < n; ++i)
+		s += square(i);
+	return s;
+}
+
+int cast_or_multiply(int *p)
+{
+	int T = 3;
+	return (T)*p;
+}
+
+int main(int argc, char **argv)
+{
+	int n = argc * 10;
+	total = sum(n);
+	if (total > 100)
+		printf("%d\n", total);
+	else
+	{
+		int k = cast_or_multiply(&n);
+		printf("%d %d\n", total, k);
+	}
+	return 0;
+}
@@ -0,0 +1,46 @@
+#!/usr/bin/env bash
+# Check that -incremental-cache gives exactly the output of a full run. We
+# analyse before.c to populate the cache, then after.c (which moves two
+# functions and edits the other two) both from scratch and incrementally, and
+# compare. A third run over after.c, served entirely from the cache, must
+# match too. The -stats counts check that the moved functions were replayed,
+# shifted, rather than analysed again.
+#
+# Both versions are preprocessed as `incremental.c`, as successive builds of
+# one source file would be.
+
+. "$(dirname "$0")/../check-lib.sh"
+requireBuilt dbgcov-tool
+TOOL="$SRC/dbgcov-tool"
+
+preprocess () {
+    cp "$here/$1" incremental.c
+    "$CC" -std=c99 -E -o incremental.i incremental.c
+}
+
+preprocess before.c
+"$TOOL" -incremental-cache=functions incremental.i -- > before.dbgcov
+
+preprocess after.c
+"$TOOL" incremental.i -- > full.dbgcov
+"$TOOL" -stats -incremental-cache=functions incremental.i -- \
+    > incremental.dbgcov 2> incremental.stats
+"$TOOL" -stats -incremental-cache=functions incremental.i -- \
+    > cached.dbgcov 2> cached.stats
+
+expected_incremental="2 functions replayed (2 moved), 2 analysed"
+expected_cached="4 functions replayed (0 moved), 0 analysed"
+for out in incremental cached; do
+    if ! diff -u full.dbgcov "$out.dbgcov"; then
+        echo "check.sh: $out output differs from a full run" 1>&2
+        status=1
+    fi
+    expected="expected_$out"
+    if ! grep -q "incremental cache: ${!expected}$" "$out.stats"; then
+        echo "check.sh: $out run did not reuse the cache as expected" \
+             "(${!expected}):" 1>&2
+        grep "incremental cache" "$out.stats" 1>&2 || true
+        status=1
+    fi
+done
+finish "incremental output matches ($(wc -l < full.dbgcov) regions)"
@@ -0,0 +1,21 @@
+#!/usr/bin/env bash
+# Check that libdbgcov, called in process, finds exactly the regions that
+# dbgcov-tool writes, whether it reads the input itself or is given its
+# contents.
+
+. "$(dirname "$0")/../check-lib.sh"
+requireBuilt dbgcov-tool "$here/client"
+
+cp "$here/../var-def-cfg/var-def-cfg.c" embedded.c
+"$CC" -std=c99 -E -o embedded.i embedded.c
+"$SRC/dbgcov-tool" embedded.i -- > tool.dbgcov
+"$here/client" embedded.i > file.dbgcov
+"$here/client" -memory embedded.i > memory.dbgcov
+
+for out in file memory; do
+    if ! diff -u tool.dbgcov $out.dbgcov; then
+        echo "check.sh: libdbgcov ($out) differs from dbgcov-tool" 1>&2
+        status=1
+    fi
+done
+finish "libdbgcov matches dbgcov-tool ($(wc -l < tool.dbgcov) regions)"
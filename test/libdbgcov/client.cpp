@@ -0,0 +1,54 @@
+// Prints the regions libdbgcov finds in a file, in the text output format:
+//
+//   client [-memory] <file> [<compiler arg>...]
+//
+// With `-memory`, the file's contents are read here and passed as a buffer.
+
+#include <cstring>
+#include <string>
+
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "libdbgcov.h"
+
+int main(int argc, char **argv) {
+  bool inMemory = argc > 1 && std::strcmp(argv[1], "-memory") == 0;
+  if (argc < 2 + inMemory) {
+    llvm::errs() << "usage: " << argv[0]
+                 << " [-memory] <file> [<compiler arg>...]\n";
+    return 1;
+  }
+  dbgcov::SourceInput input;
+  input.Path = argv[1 + inMemory];
+  input.CompilerArgs.assign(argv + 2 + inMemory, argv + argc);
+  if (inMemory) {
+    auto buffer = llvm::MemoryBuffer::getFile(input.Path);
+    if (!buffer) {
+      llvm::errs() << "Error: " << input.Path << ": "
+                   << buffer.getError().message() << "\n";
+      return 1;
+    }
+    input.InMemory = true;
+    input.Contents = (*buffer)->getBuffer().str();
+  }
+
+  auto table = dbgcov::AnalyseSource(input);
+  if (!table) {
+    llvm::errs() << "Error: " << llvm::toString(table.takeError()) << "\n";
+    return 1;
+  }
+  dbgcov::TextRegionSink sink(llvm::outs());
+  for (const auto &record : table->Regions) {
+    dbgcov::Region region;
+    region.Path = table->Files[record.File];
+    region.BeginLine = record.BeginLine;
+    region.BeginColumn = record.BeginColumn;
+    region.EndLine = record.EndLine;
+    region.EndColumn = record.EndColumn;
+    region.Kind = record.Kind;
+    region.Detail = table->Details[record.Detail];
+    sink.AddRegion(region);
+  }
+  return 0;
+}
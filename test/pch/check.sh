@@ -0,0 +1,37 @@
+#!/usr/bin/env bash
+# Check that -pch-dir gives exactly the output of analysing the preprocessed
+# file: when the PCH is built, when it is reused, and when it is rebuilt after
+# a header it includes changes. The source avoids macros outside its prefix,
+# whose regions would only match by line.
+
+. "$(dirname "$0")/../check-lib.sh"
+requireBuilt dbgcov-tool
+TOOL="$SRC/dbgcov-tool"
+cp "$here/pch.c" "$here/local.h" .
+
+compare () {
+    "$CC" -std=c99 -E -o pch.i pch.c
+    "$TOOL" pch.i -- -std=c99 > full.dbgcov
+    "$TOOL" -pch-dir=pch pch.c -- -std=c99 > "$1.dbgcov"
+    if ! diff -u full.dbgcov "$1.dbgcov"; then
+        echo "check.sh: output differs when the PCH is $1" 1>&2
+        status=1
+    fi
+}
+
+pchIdentity () { stat -c '%n %i %Y' pch/*.pch; }
+
+compare built
+built="$(pchIdentity)"
+compare reused
+if [ "$(pchIdentity)" != "$built" ]; then
+    echo "check.sh: PCH was not reused" 1>&2
+    status=1
+fi
+
+# A later modification time, whatever the file system's resolution
+sed -i 's/return dx + dy;/return dy + dx;/' local.h
+touch -d '+1 minute' local.h
+compare rebuilt
+
+finish "PCH output matches ($(wc -l < full.dbgcov) regions)"
@@ -0,0 +1,15 @@
+#ifndef LOCAL_H
+#define LOCAL_H
+
+struct point {
+  int x;
+  int y;
+};
+
+static inline int manhattan(struct point p) {
+  int dx = p.x < 0 ? -p.x : p.x;
+  int dy = p.y < 0 ? -p.y : p.y;
+  return dx + dy;
+}
+
+#endif
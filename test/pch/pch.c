@@ -0,0 +1,18 @@
+/* Everything up to the first declaration is precompiled */
+#include "local.h"
+
+#define SCALE 3
+
+int scaled(struct point p) {
+  int distance = manhattan(p);
+  int result;
+  result = distance * SCALE;
+  return result;
+}
+
+int main(void) {
+  struct point p;
+  p.x = -2;
+  p.y = 5;
+  return scaled(p);
+}
@@ -0,0 +1,55 @@
+#!/usr/bin/env bash
+# Check that compiling with the Clang plugin writes exactly what dbgcov-tool
+# writes for the same compiler's preprocessed output, both by default and
+# with a plugin argument. The source avoids macros, whose regions would only
+# match by line.
+#
+# Then compile plugin.c and other.c in one clang invocation, which runs the
+# plugin for both in one process, with a line filter for each file: the
+# options set for the first must not accumulate into those of the second.
+
+. "$(dirname "$0")/../check-lib.sh"
+requireBuilt dbgcov-tool dbgcov-plugin.so
+TOOL="$SRC/dbgcov-tool"
+PLUGIN="$SRC/dbgcov-plugin.so"
+# Must be the Clang the plugin was built against
+CLANG="${CLANG:-clang}"
+cp "$here/plugin.c" "$here/other.c" .
+
+for name in plugin other; do
+    "$CLANG" -std=c99 -E -o $name.i $name.c
+done
+
+compare () {
+    name="$1"
+    shift
+    "$TOOL" "$@" plugin.i -- > tool.dbgcov
+    pluginArgs=()
+    for arg in "$@"; do
+        pluginArgs+=("-fplugin-arg-dbgcov-${arg#-}")
+    done
+    "$CLANG" -std=c99 -fplugin="$PLUGIN" "${pluginArgs[@]}" -c -o plugin.o plugin.c
+    if ! diff -u tool.dbgcov plugin.o.dbgcov; then
+        echo "check.sh: plugin output differs ($name)" 1>&2
+        status=1
+    fi
+}
+
+compare default
+compare cfg -definedness=cfg
+
+filters=(-line-filter=plugin.c:9-14 -line-filter=other.c:8-13 -definedness=cfg)
+pluginArgs=()
+for arg in "${filters[@]}"; do
+    pluginArgs+=("-fplugin-arg-dbgcov-${arg#-}")
+done
+"$CLANG" -std=c99 -fplugin="$PLUGIN" "${pluginArgs[@]}" -c plugin.c other.c
+for name in plugin other; do
+    "$TOOL" "${filters[@]}" $name.i -- > $name.tool.dbgcov
+    if ! diff -u $name.tool.dbgcov $name.o.dbgcov; then
+        echo "check.sh: plugin output for $name.c differs (two sources)" 1>&2
+        status=1
+    fi
+done
+
+finish "plugin output matches ($(wc -l < tool.dbgcov) regions)"
@@ -0,0 +1,13 @@
+int scale(int value, int factor) {
+  int result = value;
+  if (factor > 1)
+    result *= factor;
+  return result;
+}
+
+int offset(int value, int by) {
+  int result = value + by;
+  if (result < 0)
+    result = 0;
+  return result;
+}
@@ -0,0 +1,21 @@
+#include <stdlib.h>
+
+static inline int clamp(int value, int low, int high) {
+  if (value < low)
+    return low;
+  return value > high ? high : value;
+}
+
+int total(const int *values, int count) {
+  int sum = 0;
+  for (int i = 0; i < count; ++i)
+    sum += clamp(values[i], 0, 100);
+  return sum;
+}
+
+int main(int argc, char **argv) {
+  int values[4];
+  for (int i = 0; i < 4; ++i)
+    values[i] = argc > i + 1 ? atoi(argv[i + 1]) : i;
+  return total(values, 4);
+}
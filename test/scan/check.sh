@@ -0,0 +1,41 @@
+#!/usr/bin/env bash
+# Check that dbgcov-scan counts each kind of region as awk does, whether it
+# parses the output on one thread or several (with the output repeated so
+# that it splits into several chunks), and that it reports malformed lines.
+
+. "$(dirname "$0")/../check-lib.sh"
+requireBuilt dbgcov-tool dbgcov-scan
+
+cp "$here/../var-def-cfg/var-def-cfg.c" scan.c
+"$CC" -std=c99 -E -o scan.i scan.c
+"$SRC/dbgcov-tool" scan.i -- > one.dbgcov
+# Chunks are at least 1 MiB
+cp one.dbgcov many.dbgcov
+while [ "$(wc -c < many.dbgcov)" -lt 4000000 ]; do
+    cat many.dbgcov many.dbgcov > double.dbgcov
+    mv double.dbgcov many.dbgcov
+done
+
+for input in one many; do
+    awk -F '\t' '{ count[$3]++ }
+                 END { for (kind in count) print kind, count[kind] }' \
+        $input.dbgcov | sort > $input.expected
+    for jobs in 1 4; do
+        "$SRC/dbgcov-scan" -jobs=$jobs $input.dbgcov |
+            awk 'NR > 1 && $1 != "read" && $2 != 0 { print $1, $2 }' |
+            sort > $input.$jobs.counts
+        if ! diff -u $input.expected $input.$jobs.counts; then
+            echo "check.sh: wrong counts for $input with -jobs=$jobs" 1>&2
+            status=1
+        fi
+    done
+done
+
+printf 'scan.c:1:1\tscan.c:1:2\tNoSuchKind\tx\n' >> many.dbgcov
+if "$SRC/dbgcov-scan" -jobs=4 many.dbgcov > /dev/null 2> bad.err ||
+        ! grep -q "malformed region on line $(wc -l < many.dbgcov)" bad.err; then
+    echo "check.sh: malformed line not reported" 1>&2
+    cat bad.err 1>&2
+    status=1
+fi
+finish "dbgcov-scan counts match ($(wc -l < one.dbgcov) regions)"
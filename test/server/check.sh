@@ -0,0 +1,55 @@
+#!/usr/bin/env bash
+# Check that compiles fall back to running dbgcov-tool themselves when the
+# server goes away mid-build: the first source is served, the second finds
+# the server killed, and the third reaches a server that drops connections
+# unanswered. Each must still get the output a direct run gives.
+
+. "$(dirname "$0")/../check-lib.sh"
+requireBuilt dbgcov-tool dbgcov
+TOOL="$SRC/dbgcov-tool"
+CFLAGS="$("$DBGCOV_PREFIX/bin/dbgcov-cflags")"
+
+for name in var-def var-def-cfg var-def-for; do
+    cp "$here/../$name/$name.c" .
+done
+
+export DBGCOV_SERVER="$work/dbgcov.sock"
+"$TOOL" -server="$DBGCOV_SERVER" -- 2> server.log &
+server_pid=$!
+trap 'kill $server_pid 2>/dev/null; rm -rf "$work"' EXIT
+while [ ! -S "$DBGCOV_SERVER" ]; do sleep 0.05; done
+
+compile () {
+    if ! "$CC" $CFLAGS -std=c99 -save-temps -c "$1.c" 2> "$1.log"; then
+        echo "check.sh: compiling $1.c failed ($2)" 1>&2
+        cat "$1.log" 1>&2
+        status=1
+        return
+    fi
+    "$TOOL" "$1.i" -- > "$1.expected"
+    if ! diff -u "$1.expected" "$1.i.dbgcov"; then
+        echo "check.sh: wrong output for $1.c ($2)" 1>&2
+        status=1
+    fi
+}
+
+compile var-def "served"
+kill -9 $server_pid
+wait $server_pid 2>/dev/null || true
+compile var-def-cfg "server killed"
+
+# Accept each connection and close it at once
+rm -f "$DBGCOV_SERVER"
+python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+s.bind(sys.argv[1])
+s.listen(8)
+while True:
+    s.accept()[0].close()
+' "$DBGCOV_SERVER" &
+server_pid=$!
+while [ ! -S "$DBGCOV_SERVER" ]; do sleep 0.05; done
+compile var-def-for "connection dropped"
+
+finish "compiles fall back when the server goes away"
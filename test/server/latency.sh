@@ -0,0 +1,67 @@
+#!/usr/bin/env bash
+# Compare per-TU latency of running dbgcov-tool once per file (as the driver
+# does by default) against sending the same files to a `dbgcov-tool -server`.
+# Also checks that both modes produce identical output.
+#
+# Usage: latency.sh [file.c...]   (defaults to the other tests' sources)
+# Needs `socat` to talk to the server socket.
+
+set -e
+here="$(cd "$(dirname "$0")" && pwd)"
+DBGCOV_PREFIX="${DBGCOV_PREFIX:-$(cd "$here/../.." && pwd)}"
+TOOL="$DBGCOV_PREFIX/src/dbgcov-tool"
+CC="${CC:-gcc}"
+
+command -v socat >/dev/null || { echo "latency.sh: needs socat" 1>&2; exit 1; }
+[ -x "$TOOL" ] || { echo "latency.sh: build $TOOL first" 1>&2; exit 1; }
+
+work="$(mktemp -d)"
+server_pid=
+cleanup () {
+    [ -n "$server_pid" ] && kill "$server_pid" 2>/dev/null
+    rm -rf "$work"
+}
+trap cleanup EXIT
+
+if [ $# -eq 0 ]; then
+    set -- "$here"/../*/*.c
+fi
+inputs=()
+for src in "$@"; do
+    i="$work/$(basename "${src%.c}").i"
+    "$CC" -std=c99 -E -o "$i" "$src"
+    inputs+=("$i")
+done
+
+now_us () { echo $(( $(date +%s%N) / 1000 )); }
+
+socket="$work/dbgcov.sock"
+"$TOOL" -server="$socket" -- 2>"$work/server.log" &
+server_pid=$!
+while [ ! -S "$socket" ]; do sleep 0.05; done
+
+printf '%-32s %12s %12s\n' "input" "exec (us)" "server (us)"
+total_exec=0
+total_server=0
+status=0
+for i in "${inputs[@]}"; do
+    start=$(now_us)
+    "$TOOL" "$i" -- >"$i.exec.dbgcov" 2>/dev/null
+    exec_us=$(( $(now_us) - start ))
+
+    start=$(now_us)
+    reply="$(printf '%s\n%s\n%s\n' "$work" "$i" "$i.server.dbgcov" | \
+        socat - UNIX-CONNECT:"$socket")"
+    server_us=$(( $(now_us) - start ))
+
+    printf '%-32s %12d %12d\n' "$(basename "$i")" "$exec_us" "$server_us"
+    total_exec=$(( total_exec + exec_us ))
+    total_server=$(( total_server + server_us ))
+    if [ "$reply" != 0 ] || ! cmp -s "$i.exec.dbgcov" "$i.server.dbgcov"; then
+        echo "  MISMATCH: server reply $reply, outputs differ" 1>&2
+        status=1
+    fi
+done
+n=${#inputs[@]}
+printf '%-32s %12d %12d\n' "mean" $(( total_exec / n )) $(( total_server / n ))
+exit $status
@@ -12,19 +12,19 @@ int example(
     a = 1; // initialised from multiple line block
     read(a);
   } else {
-    a = 2; // TODO: CFG analysis would show `a` as defined for all paths
+    a = 2; // with -definedness=cfg, `a` is defined for all paths after this
   }
 
   goto undefined;
 definition:
-  unstructured = a + n; // TODO: unstructured definition out of source line order
+  unstructured = a + n; // unstructured definition out of source line order
   goto defined;
 undefined:
 
   if (cond(-n))
     b = -1; // initialised from single line block
   else
-    b = 0; // TODO: CFG analysis would show `b` as defined for all paths
+    b = 0; // with -definedness=cfg, `b` is defined for all paths after this
   delayed = 2; // definition after declaration
   for (int i = 0; i < n; i++) { // block header definition
     delayed++;
@@ -35,3 +35,14 @@ defined:
 
   return a + b + delayed + unstructured;
 }
+
+int loop(int n) {
+  int sum = 0;
+  for (int i = 0; i < n; i++) {
+    int step; // loop-local, not initialised
+    read(i);
+    step = i * 2; // must be defined only from here, despite the back edge
+    sum += step;
+  }
+  return sum;
+}